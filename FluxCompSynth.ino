@@ -9,30 +9,78 @@
 #include "config.h"
 #include <FluxSynth.h> /* https://sourceforge.net/projects/flexamysynth/files/ */
 #include <SoftwareSerial.h>
-#include <MIDI.h>
 #include <PgmChange.h>
 #include <Wire.h>
 #include <LiquidCrystalPlus_I2C.h> /* https://github.com/dcoredump/LiquidCrystalPlus_I2C (https://github.com/marcoschwartz/LiquidCrystal_I2C) */
-#include <RotaryEncoderDir.h> /* https://github.com/dcoredump/RotaryEncoderDir.git */
-#include <Bounce2.h> /* https://github.com/thomasfredericks/Bounce2 */
 #include <EEPROM.h>
 #include "FluxVoiceNames.h" // Voice names in PROGMEM
+#include "SetupLibrary.h"
+#ifdef SETUP_LIBRARY_SD
+#include <SPI.h>
+#include <SD.h>
+#endif
 
 #if !defined(__AVR_ATmega2560__)  // Arduino MEGA2560
 #error Arduino-MEGA-2560 is needed!
 #else
 //#define EXTENDED_SETUP
-#define FLUXAMA_MIDI_IN Serial1
+// MIDI-IN on USART1 (RX1, pin 19), read by our own receive interrupt
+#define FLUXAMA_MIDI_IN_UBRR UBRR1
+#define FLUXAMA_MIDI_IN_UCSRA UCSR1A
+#define FLUXAMA_MIDI_IN_UCSRB UCSR1B
+#define FLUXAMA_MIDI_IN_UCSRC UCSR1C
+#define FLUXAMA_MIDI_IN_UDR UDR1
+#define FLUXAMA_MIDI_IN_RX_vect USART1_RX_vect
 #endif
 
 #define LED_PIN 13
+#define SD_CS_PIN 53 // SD card chip select (SETUP_LIBRARY_SD)
+#define SD_LIBRARY_FILE "SETUPS.LIB"
+#define SD_LIBRARY_SLOTS 500
 
 #define LCD_I2C_ADDRESS 0x3f
 #define LCD_CHARS 20
 #define LCD_LINES 4
+#define LCD_FLUSH_CHARS 4 // Max characters sent per pass (I2C: ~0.5ms each)
 
 #define FLUXAMA_MIDI_OUT_PIN 4
 #define FLUXAMA_MIDI_IN_PIN 3
+#define FLUXAMA_TX_QUEUE_SIZE 128
+#define FLUXAMA_TX_BYTES_PER_LOOP 2 // SoftwareSerial blocks ~320us per byte
+#define FLUXAMA_RT_QUEUE_SIZE 32 // Notes, bend, aftertouch go ahead of bulk data
+#define FLUXAMA_BULK_UNIT 16 // Max bytes per parameter packet, notes wait ~5ms (8ms behind setVoiceReserve)
+#define FLUXAMA_BAUD 31250
+#define FLUXAMA_THRU_QUEUE_SIZE 64 // MIDI-IN messages waiting for the wire
+
+#define MORPH_LINK_SHARE 25 // % of the Fluxama link a morph may use
+#define MORPH_BURST 24 // Max bytes a morph may send at once
+#define MORPH_SENDS_PER_STEP 4
+#define MORPH_UI_MS 2000 // Morph time on a long press of button 2
+
+#if defined(FLUXAMA_HW_UART)
+#if FLUXAMA_HW_UART == 2
+#define FLUXAMA_UBRR UBRR2
+#define FLUXAMA_UCSRA UCSR2A
+#define FLUXAMA_UCSRB UCSR2B
+#define FLUXAMA_UCSRC UCSR2C
+#define FLUXAMA_UDR UDR2
+#define FLUXAMA_UDRE_vect USART2_UDRE_vect
+#elif FLUXAMA_HW_UART == 3
+#define FLUXAMA_UBRR UBRR3
+#define FLUXAMA_UCSRA UCSR3A
+#define FLUXAMA_UCSRB UCSR3B
+#define FLUXAMA_UCSRC UCSR3C
+#define FLUXAMA_UDR UDR3
+#define FLUXAMA_UDRE_vect USART3_UDRE_vect
+#else
+#error FLUXAMA_HW_UART must be 2 or 3
+#endif
+// Bit positions are the same for all USARTs
+#define FLUXAMA_TXEN TXEN0
+#define FLUXAMA_UDRIE UDRIE0
+#define FLUXAMA_UDRE UDRE0
+#define FLUXAMA_8N1 (_BV(UCSZ01) | _BV(UCSZ00))
+#endif
 
 #define DEBOUNCE_INTERVAL_MS 5
 #define ENCODER1_PIN_A 5
@@ -52,6 +100,16 @@
 #else
 #define MAX_ENCODER 2
 #endif
+#define ENCODER_STEPS 4 // Quadrature states per detent
+#define ENCODER_SLOW_MS 60 // Detents this far apart move one step
+#define ENCODER_FAST_MS 8 // Detents this close move the most (encoder_curve)
+#define UI_SPIN_HOLD_MS 120 // Voice name waits until the encoder rests that long
+#define INPUT_QUEUE_SIZE 16 // Encoder/button events, power of 2
+// Input event type, low nibble is the encoder number
+#define INPUT_TURN 0x00 // value: detents turned
+#define INPUT_PRESS 0x10
+#define INPUT_RELEASE 0x20
+#define BUTTON_LONG_MS 600 // Held that long, a button does its second function
 
 #define POT1_PIN A0
 #define POT2_PIN A1
@@ -70,7 +128,12 @@
 #define POT14_PIN A13
 #define POT15_PIN A14
 #define POT16_PIN A15
+#define MAX_POT 16
+#else
+#define MAX_POT 4
 #endif
+#define POT_OVERSAMPLE 8 // ADC conversions summed per reading (~1ms)
+#define POT_HYSTERESIS 96 // 14 bit units, 3/4 of a 7 bit step
 
 #define REFRESH_BUT1 0
 #define REFRESH_BUT2 1
@@ -85,6 +148,34 @@
 #define REFRESH_POT 6
 #define REFRESH 7
 
+// Voice browsing (button 1): programs, first program of the next family,
+// first name with the next letter
+#define BROWSE_PROGRAM 0
+#define BROWSE_FAMILY 1
+#define BROWSE_LETTER 2
+
+// Boot sequence (boot_step), most audible first
+#define BOOT_RESET 0
+#define BOOT_POSTPROC 1
+#define BOOT_LOAD 2
+#define BOOT_SOUNDS 3 // programs and volumes, per channel
+#define BOOT_GLOBALS 4
+#define BOOT_READY 5 // waits until all of that is out
+#define BOOT_DETAILS 6 // pan, sends, bend range, per channel
+#define BOOT_EFFECTS 7
+#define BOOT_DONE 8
+#define BOOT_TX_FREE 64 // queue room needed for the next step
+
+// Tasks (task_run), in order of priority
+#define TASK_TX 0
+#define TASK_INPUT 1
+#define TASK_SETUP 2
+#define TASK_EEPROM 3
+#define TASK_UI 4
+#define TASK_LCD 5
+#define TASK_POTS 6
+#define TASK_EVENT 0xFFFF // period: runs when signaled (task_signal)
+
 struct SynthGlobal
 {
   int8_t level = 50; // negative means OFF
@@ -123,6 +214,9 @@ struct SynthVoice
   uint8_t bend_range = 12;
 } synth_voice_config[16];
 
+// MIDI-IN zones (splits, layers, remaps), stored with each setup
+FluxRouting synth_routing;
+
 #ifdef EXTENDED_SETUP
 struct SynthDrumMix
 {
@@ -135,44 +229,319 @@ struct SynthDrumMix
 } synth_drummix_config[79]; // Note 27 (D#1)- 106( A#7)
 #endif
 
+// Encoder with button, sampled by the Timer0 compare interrupt
+struct InputEncoder
+{
+  volatile uint8_t *pin_a, *pin_b, *pin_button;
+  uint8_t mask_a, mask_b, mask_button;
+  uint8_t state; // last A/B
+  int8_t quarter; // quadrature steps towards the next detent
+  int8_t delta; // detents not queued yet
+  bool pressed;
+  uint8_t bounce; // ms the button has been in a new state
+};
+
+struct InputEvent
+{
+  uint8_t type;
+  int8_t value;
+  uint16_t ms; // millis() when it happened
+};
+
+// Scheduler task (task_run)
+struct Task
+{
+  void (*run)(void);
+  const char *name; // PROGMEM
+  uint16_t period_ms; // 0: every pass, TASK_EVENT: when signaled
+  uint16_t budget_us;
+  volatile bool signaled; // task_signal(), may be an interrupt
+  uint32_t last_ms;
+  uint32_t max_us;
+  uint32_t sum_us;
+  uint16_t runs;
+  uint16_t overruns; // runs over budget
+};
+
 //**************************************************************************
 // GLOBALS
 
 // for  LCD-Modul QC2204A LCD2004 I2C-Controller
 LiquidCrystalPlus_I2C lcd(LCD_I2C_ADDRESS, LCD_CHARS, LCD_LINES);
 
+// LCD framebuffer, the UI writes here (lcd_show) and lcd_flush() sends
+// the changed cells
+char lcd_fb[LCD_LINES][LCD_CHARS];
+uint8_t lcd_dirty[LCD_LINES][(LCD_CHARS + 7) / 8]; // bit per cell
+uint8_t lcd_pending = 0; // dirty cells
+
 // Fluxama serial port
+#ifndef FLUXAMA_HW_UART
 SoftwareSerial fluxama(255, FLUXAMA_MIDI_OUT_PIN); // 255 = OFF
+#endif
+byte fluxama_tx_queue[FLUXAMA_TX_QUEUE_SIZE];
+byte fluxama_rt_queue[FLUXAMA_RT_QUEUE_SIZE];
 
 // MIDI-IN port
 //SoftwareSerial midiport(FLUXAMA_MIDI_IN_PIN, 255); // 255 = OFF
-MIDI_CREATE_INSTANCE(HardwareSerial, FLUXAMA_MIDI_IN, midi_in);
+byte fluxama_thru_queue[FLUXAMA_THRU_QUEUE_SIZE];
 
 // Synth
 FluxSynth synth;
 
-// Encoder
-RotaryEncoderDir Encoder1(ENCODER1_PIN_A, ENCODER1_PIN_B);
-RotaryEncoderDir Encoder2(ENCODER2_PIN_A, ENCODER2_PIN_B);
+// Encoders and their buttons: A, B, button
+const uint8_t encoder_pins[MAX_ENCODER][3] PROGMEM = {
+  { ENCODER1_PIN_A, ENCODER1_PIN_B, ENCODER1_BUTTON_PIN },
+  { ENCODER2_PIN_A, ENCODER2_PIN_B, ENCODER2_BUTTON_PIN },
 #ifdef EXTENDED_SETUP
-RotaryEncoderDir Encoder3(ENCODER3_PIN_A, ENCODER3_PIN_B);
-RotaryEncoderDir Encoder4(ENCODER4_PIN_A, ENCODER4_PIN_B);
+  { ENCODER3_PIN_A, ENCODER3_PIN_B, ENCODER3_BUTTON_PIN },
+  { ENCODER4_PIN_A, ENCODER4_PIN_B, ENCODER4_BUTTON_PIN },
 #endif
+};
+InputEncoder encoders[MAX_ENCODER];
+uint16_t encoder_ms[MAX_ENCODER]; // last turn
+uint16_t button_ms[MAX_ENCODER]; // last press
+uint16_t encoder_interval[MAX_ENCODER]; // ms per detent
+
+// Acceleration curves: value ranges up to <span> move up to <steps> per
+// detent when turned fast, first match wins
+const uint8_t encoder_curve[][2] PROGMEM = {
+  { 16, 1 }, // channel
+  { 64, 4 },
+  { 255, 12 } // voice
+};
 
-// Buttons (debouncer)
-Bounce Button1 = Bounce(ENCODER1_BUTTON_PIN, DEBOUNCE_INTERVAL_MS);
-Bounce Button2 = Bounce(ENCODER2_BUTTON_PIN, DEBOUNCE_INTERVAL_MS);
+// Potentiometers, scanned by the ADC interrupt (potsBegin). Readings are
+// published as 14 bit values, pot_changed has a bit per moved pot.
+const uint8_t pot_pins[MAX_POT] PROGMEM = {
+  POT1_PIN, POT2_PIN, POT3_PIN, POT4_PIN,
 #ifdef EXTENDED_SETUP
-Bounce Button3 = Bounce(ENCODER3_BUTTON_PIN, DEBOUNCE_INTERVAL_MS);
-Bounce Button4 = Bounce(ENCODER4_BUTTON_PIN, DEBOUNCE_INTERVAL_MS);
+  POT5_PIN, POT6_PIN, POT7_PIN, POT8_PIN,
+  POT9_PIN, POT10_PIN, POT11_PIN, POT12_PIN,
+  POT13_PIN, POT14_PIN, POT15_PIN, POT16_PIN
 #endif
+};
+int16_t pot_filter[MAX_POT]; // ADC interrupt only
+volatile uint16_t pot_value[MAX_POT];
+volatile uint16_t pot_changed = 0;
+uint8_t pot_channel = 0; // ADC interrupt only
+uint8_t pot_last = 0xff; // last moved pot and its value, for show_ui()
+uint8_t pot_last_value;
+uint8_t pot_sample = 0;
+uint16_t pot_sum = 0;
+
+// Input events, written by the sampling interrupt only, read by
+// task_input() only, so no locking
+InputEvent input_queue[INPUT_QUEUE_SIZE];
+volatile uint8_t input_head = 0;
+volatile uint8_t input_tail = 0;
 
 // vars
 int8_t voice = -1;
 uint8_t channel = 0;
 uint8_t bank = PATCH_BANK0;
-uint8_t refresh = REFRESH;
-const uint8_t max_storage = EEPROM.length() / (sizeof(SynthVoice) * 16 + sizeof(SynthGlobal));
+uint8_t browse = BROWSE_PROGRAM; // what encoder 1 steps through
+uint16_t setup_current = 0; // setup last switched to, 0 is the live one
+uint8_t refresh = bit(REFRESH);
+uint8_t boot_state = BOOT_RESET;
+uint8_t boot_channel = 0;
+uint32_t boot_ready_ms = 0; // power-on to first playable note
+uint32_t input_ms = 0; // last encoder/button event
+
+// Setup as last sent to the synth, restore_setup() only sends what differs
+SynthGlobal applied_config;
+SynthVoice applied_voice[16];
+bool applied_valid = false;
+
+// Setup morph (morph_start), synth_config/synth_voice_config hold the
+// interpolated values while it runs
+SynthGlobal morph_from_config, morph_to_config;
+SynthVoice morph_from_voice[16], morph_to_voice[16];
+bool morph_active = false;
+uint32_t morph_start_ms;
+uint32_t morph_last_ms;
+uint16_t morph_ms;
+uint32_t morph_credit; // 1/1000 bytes
+
+// Morphed fields by audibility: offset, weight per step of error, bytes sent
+#define MORPH_SIGNED 0x80 // weight flag: int8_t field
+const uint8_t morph_global_param[][3] PROGMEM = {
+  { offsetof(SynthGlobal, level), 8 | MORPH_SIGNED, 8 },
+  { offsetof(SynthGlobal, reverb_level), 4, 11 },
+  { offsetof(SynthGlobal, chorus_level), 4, 11 },
+  { offsetof(SynthGlobal, pan), 3 | MORPH_SIGNED, 11 },
+  { offsetof(SynthGlobal, reverb_time), 1, 11 },
+  { offsetof(SynthGlobal, reverb_feedback), 1, 11 },
+  { offsetof(SynthGlobal, chorus_delay), 1, 11 },
+  { offsetof(SynthGlobal, chorus_feedback), 1, 11 },
+  { offsetof(SynthGlobal, chorus_rate), 1, 11 },
+  { offsetof(SynthGlobal, chorus_depth), 1, 11 }
+};
+const uint8_t morph_voice_param[][3] PROGMEM = {
+  { offsetof(SynthVoice, volume), 8 | MORPH_SIGNED, 3 },
+  { offsetof(SynthVoice, pan), 3 | MORPH_SIGNED, 9 },
+  { offsetof(SynthVoice, reverb_send), 2, 3 },
+  { offsetof(SynthVoice, chorus_send), 2, 3 }
+};
+#define MORPH_GLOBALS (sizeof(morph_global_param) / 3)
+#define MORPH_VOICE_PARAMS (sizeof(morph_voice_param) / 3)
+
+// EEPROM setup slot: global config, 16 voice configs, MIDI-IN routing
+#define SETUP_VOICE_OFFSET sizeof(SynthGlobal)
+#define SETUP_ROUTING_OFFSET (SETUP_VOICE_OFFSET + sizeof(SynthVoice) * 16)
+#define SETUP_SIZE (SETUP_ROUTING_OFFSET + sizeof(FluxRouting))
+
+// Setup 0 is the live setup. It's written behind from a RAM copy
+// (storage_put) and moves round a ring of LIVE_SLOTS copies to spread
+// the wear, each led by a header: sequence number, version, CRC over the
+// setup (and its size). The CRC is written when a commit is through, a
+// slot cut short reads as corrupt. Setups 1.. follow the ring.
+#define LIVE_SLOTS 4
+#define LIVE_VERSION 1
+#define LH_SEQ 0
+#define LH_VERSION 1
+#define LH_CRC 2
+#define LIVE_HEADER 4
+#define LIVE_SLOT_SIZE (LIVE_HEADER + SETUP_SIZE)
+#define LIVE_CRC_CHUNK 16 // bytes checksummed per commit step
+#define LIVE_ROTATE 8 // commits to a slot before moving on
+#define SETUPS_OFFSET (LIVE_SLOTS * LIVE_SLOT_SIZE)
+#define STORAGE_IDLE_MS 500 // no input for that long before committing
+
+// Setups 1.. are stored packed (preset_pack), fields equal to the
+// defaults left out, in chains of PRESET_BLOCK_SIZE byte blocks. A
+// directory byte per setup points to the first block, each block starts
+// with the number of the next one. The data runs on in the rest of the
+// blocks, led by the header. The CRC also covers the format id and the
+// setup number, so formatting means counting the format id up.
+#define PRESETS 63
+#define PRESET_VERSION 2
+#ifdef EXTENDED_SETUP
+#define PRESET_LAYOUT (PRESET_VERSION | 0x80) // more global fields
+#else
+#define PRESET_LAYOUT PRESET_VERSION
+#endif
+#define PRESET_BLOCK_SIZE 32
+#define PRESET_BLOCK_DATA (PRESET_BLOCK_SIZE - 1) // after the link
+#define PRESET_MAX_BLOCKS 6
+#define PRESET_NONE 0xFF
+#define PRESET_FORMAT_ADDR SETUPS_OFFSET
+#define PRESET_DIR_ADDR (PRESET_FORMAT_ADDR + 1)
+#define PRESET_BLOCKS_ADDR (PRESET_DIR_ADDR + PRESETS)
+#define PRESET_BLOCKS ((E2END + 1 - PRESET_BLOCKS_ADDR) / PRESET_BLOCK_SIZE)
+// Header: version (PRESET_LAYOUT), payload length, CRC (2)
+#define PH_VERSION 0
+#define PH_LENGTH 1
+#define PH_CRC 2
+#define PRESET_HEADER 4
+#define PRESET_SIGNED 0x80 // field flag: sign extend
+const uint8_t max_storage = 1 + PRESETS;
+
+uint8_t live_cache[SETUP_SIZE];
+uint8_t live_dirty[(SETUP_SIZE + 7) / 8]; // bytes not in EEPROM yet
+uint16_t live_pending = 0; // dirty bytes
+uint16_t live_pos = 0; // commit scan position
+uint8_t live_slot = 0;
+uint8_t live_seq = 0;
+uint8_t live_commits = 0; // to the current slot
+bool live_session = false; // commit in progress
+uint16_t live_crc; // of live_cache, for the slot header
+uint16_t live_crc_pos = 0; // bytes of live_cache in live_crc
+uint8_t live_head_pos = 0; // header bytes written
+
+uint8_t preset_format; // current format id
+uint8_t preset_used[(PRESET_BLOCKS + 7) / 8]; // blocks of valid setups
+uint8_t preset_image[SETUP_SIZE]; // unpacked setup (setup_open)
+uint8_t preset_buf[PRESET_MAX_BLOCKS * PRESET_BLOCK_DATA]; // header + packed
+uint16_t preset_bit; // bit position in the packed data
+
+#ifdef SETUP_LIBRARY_SD
+// Setup library in one file on the SD card. Writing past the end pads
+// with 0xFF, which reads as an empty slot.
+class SdMedia : public LibraryMedia
+{
+  public:
+    File file;
+
+    bool read(uint32_t pos, uint8_t *buf, uint16_t len)
+    {
+      if (!file || pos + len > file.size() || !file.seek(pos))
+        return (false);
+      return (file.read(buf, len) == len);
+    }
+
+    bool write(uint32_t pos, const uint8_t *buf, uint16_t len)
+    {
+      if (!file)
+        return (false);
+      if (pos > file.size())
+      {
+        file.seek(file.size());
+        while (file.size() < pos)
+          if (file.write(uint8_t(0xff)) != 1)
+            return (false);
+      }
+      if (!file.seek(pos))
+        return (false);
+      return (file.write(buf, len) == len);
+    }
+
+    void sync()
+    {
+      file.flush();
+    }
+} library_media;
+SetupLibrary library;
+bool library_ok = false;
+#endif
+
+// Packed fields: offset, bits | PRESET_SIGNED. Bits are chosen for the
+// values the synth takes, negative means OFF where noted at the struct.
+const uint8_t preset_global_fields[][2] PROGMEM = {
+  { offsetof(SynthGlobal, level), 8 },
+  { offsetof(SynthGlobal, pan), 8 },
+  { offsetof(SynthGlobal, transpose), 8 },
+  { offsetof(SynthGlobal, reverb_level), 7 },
+  { offsetof(SynthGlobal, reverb_program), 4 | PRESET_SIGNED },
+  { offsetof(SynthGlobal, reverb_time), 7 },
+  { offsetof(SynthGlobal, reverb_feedback), 7 },
+  { offsetof(SynthGlobal, reverb_character), 3 },
+  { offsetof(SynthGlobal, chorus_level), 7 },
+  { offsetof(SynthGlobal, chorus_program), 4 | PRESET_SIGNED },
+  { offsetof(SynthGlobal, chorus_delay), 7 },
+  { offsetof(SynthGlobal, chorus_feedback), 7 },
+  { offsetof(SynthGlobal, chorus_rate), 7 },
+  { offsetof(SynthGlobal, chorus_depth), 7 },
+  { offsetof(SynthGlobal, clipping), 7 },
+#ifdef EXTENDED_SETUP
+  { offsetof(SynthGlobal, eq_bass), 8 },
+  { offsetof(SynthGlobal, eq_lowmid), 8 },
+  { offsetof(SynthGlobal, eq_highmid), 8 },
+  { offsetof(SynthGlobal, eq_high), 8 },
+  { offsetof(SynthGlobal, surround_postproc), 3 },
+#endif
+};
+const uint8_t preset_voice_fields[][2] PROGMEM = {
+  { offsetof(SynthVoice, patch), 8 },
+  { offsetof(SynthVoice, bank), 7 },
+  { offsetof(SynthVoice, volume), 8 },
+  { offsetof(SynthVoice, pan), 8 },
+  { offsetof(SynthVoice, transpose), 8 },
+  { offsetof(SynthVoice, reverb_send), 7 },
+  { offsetof(SynthVoice, chorus_send), 7 },
+  { offsetof(SynthVoice, bend_range), 7 }
+};
+const uint8_t preset_routing_fields[][2] PROGMEM = {
+  { offsetof(FluxRouting, inChannel), 4 },
+  { offsetof(FluxRouting, zones), 3 }
+};
+const uint8_t preset_zone_fields[][2] PROGMEM = {
+  { offsetof(FluxZone, lowKey), 7 },
+  { offsetof(FluxZone, highKey), 7 },
+  { offsetof(FluxZone, channel), 8 },
+  { offsetof(FluxZone, transpose), 8 },
+  { offsetof(FluxZone, velocity), 8 }
+};
 //
 //**************************************************************************
 // MAIN FUNCTIONS
@@ -183,6 +552,7 @@ void setup(void)
   Serial.begin(115200);
   Serial.println(F("Start"));
   //Serial.println(sizeof(SynthVoice)*16+sizeof(SynthGlobal));
+  voice_name_bench();
 #endif
 
   lcd.init();
@@ -190,54 +560,43 @@ void setup(void)
   lcd.cursor_off();
   lcd.backlight();
   lcd.noAutoscroll();
-  lcd.clear();
+  lcd_clear();
   lcd.display();
 
-  lcd.show(0, 0, 20, "FluxCompSynth");
+  lcd_show(0, 0, 20, "FluxCompSynth");
 
-  fluxama.begin(31250);
+#ifdef FLUXAMA_HW_UART
+  fluxamaBegin();
   synth.begin();
   synth.sendByte = sendMidiByte;
-  synth.midiReset();
-  synth.GS_Reset();
-  synth.GM_Reset();
-  synth.postprocGeneralMidi(false);  // Surround + EQ on GM
-  synth.postprocReverbChorus(false); // Surround + EQ on Reverb and Chorus
-  synth.surroundMonoIn(false);
-
-  //midi_in.begin(MIDI_CHANNEL_OMNI);
-
-  pinMode(ENCODER1_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(ENCODER2_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(POT1_PIN, INPUT_PULLUP);
-  pinMode(POT2_PIN, INPUT_PULLUP);
-  pinMode(POT3_PIN, INPUT_PULLUP);
-  pinMode(POT4_PIN, INPUT_PULLUP);
-  pinMode(LED_PIN, OUTPUT);
-#ifdef EXTENDED_SETUP
-  pinMode(ENCODER3_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(ENCODER4_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(POT5_PIN, INPUT_PULLUP);
-  pinMode(POT6_PIN, INPUT_PULLUP);
-  pinMode(POT7_PIN, INPUT_PULLUP);
-  pinMode(POT8_PIN, INPUT_PULLUP);
-  pinMode(POT9_PIN, INPUT_PULLUP);
-  pinMode(POT10_PIN, INPUT_PULLUP);
-  pinMode(POT11_PIN, INPUT_PULLUP);
-  pinMode(POT12_PIN, INPUT_PULLUP);
-  pinMode(POT13_PIN, INPUT_PULLUP);
-  pinMode(POT14_PIN, INPUT_PULLUP);
-  pinMode(POT15_PIN, INPUT_PULLUP);
-  pinMode(POT16_PIN, INPUT_PULLUP);
+  synth.setTxQueue(fluxama_tx_queue, FLUXAMA_TX_QUEUE_SIZE, fluxamaKick);
+#else
+  fluxama.begin(FLUXAMA_BAUD);
+  synth.begin();
+  synth.sendByte = sendMidiByte;
+  synth.setTxQueue(fluxama_tx_queue, FLUXAMA_TX_QUEUE_SIZE);
 #endif
+  synth.setRtQueue(fluxama_rt_queue, FLUXAMA_RT_QUEUE_SIZE);
+  synth.setBulkUnit(FLUXAMA_BULK_UNIT);
+  // Resets and the setup are sent by boot_step() from loop()
+
+  // MIDI thru: received messages are merged into the synth output
+  synth.setThruQueue(fluxama_thru_queue, FLUXAMA_THRU_QUEUE_SIZE);
+  midiInBegin();
+
+  inputBegin();
+  potsBegin();
+  pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
 
+  storage_begin();
+#ifdef SETUP_LIBRARY_SD
+  library_begin();
+#endif
 #ifdef INIT_STORAGE
   init_storage();
-  for (uint8_t i = 0; i < 16; i++)
-    store_setup(i);
-#else
-  restore_setup(0);
+  store_setup(0);
+  storage_flush();
 #endif
 
   //lcd.clear();
@@ -245,234 +604,2012 @@ void setup(void)
 
 void loop(void)
 {
-  int8_t dir = 0;
+  // MIDI-IN is forwarded to Fluxama by the receive interrupt (midiInBegin),
+  // everything else is a task
+  task_run();
+}
 
-  // Forward MIDI-IN to Fluxama
-  //fluxama.write(midi_in.read());
+//**************************************************************************
+// FUNCTIONS
 
-  // do the update stuff
-  Encoder1.tick();
-  Encoder2.tick();
+// Feed queued synth data to the wire, a few bytes per pass
+// (with FLUXAMA_HW_UART this only restarts the interrupt after a settle time)
+void task_tx(void)
+{
+  synth.txService(FLUXAMA_TX_BYTES_PER_LOOP);
+}
 
-  // handle buttons
-  if (Button1.update())
-  {
-    if (Button1.fell())
-    {
-      bitSet(refresh, REFRESH_BUT1);
-    }
-  }
-  if (Button2.update())
+// Encoder and button events from the sampling interrupt, turns are
+// summed up per encoder and applied once
+void task_input(void)
+{
+  InputEvent ev;
+  int8_t dir[MAX_ENCODER] = { 0 };
+  uint8_t n;
+
+  while (input_pop(ev))
   {
-    if (Button2.fell())
+    input_ms = millis();
+    n = ev.type & 0x0f;
+    switch (ev.type & 0xf0)
     {
-      bitSet(refresh, REFRESH_BUT2);
-      synth_voice_config[channel].patch = (bank << 7) | voice;
-      setSynth(channel);
-      store_voice_setup(0, channel);
+      case INPUT_TURN:
+        dir[n] += ev.value;
+        encoder_interval[n] = uint16_t(ev.ms - encoder_ms[n]) / abs(ev.value);
+        encoder_ms[n] = ev.ms;
+        break;
+      case INPUT_PRESS:
+        button_ms[n] = ev.ms;
+        break;
+      case INPUT_RELEASE:
+        if (uint16_t(ev.ms - button_ms[n]) >= BUTTON_LONG_MS)
+          button_held(n);
+        else
+          button_pressed(n);
+        break;
     }
   }
 
   // Encoder1 handling
-  dir = Encoder1.hasChanged();
-  if (dir)
+  if (dir[0])
   {
     bitSet(refresh, REFRESH_ENC1);
-    voice = uint8_t(encoder_move(dir, -1, 127, long(voice)));
+    if (browse == BROWSE_PROGRAM || voice < 0 || channel == 9)
+      voice = uint8_t(encoder_move(dir[0], encoder_interval[0], -1, 127, long(voice)));
+    else
+      voice = browse_jump(voice, dir[0]);
     synth_voice_config[channel].patch = voice;
   }
 
   // Encoder2 handling
-  dir = Encoder2.hasChanged();
-  if (dir)
+  if (dir[1])
   {
     bitSet(refresh, REFRESH_ENC2);
-    channel = uint8_t(encoder_move(dir, 0, 15, long(channel)));
+    channel = uint8_t(encoder_move(dir[1], encoder_interval[1], 0, 15, long(channel)));
     voice = synth_voice_config[channel].patch;
   }
+}
 
-  // show UI
-  if (refresh)
-    show_ui();
-
-#ifdef PLAY_TEST_CHORD
-  boolean no = false;
-  if (millis() % 2000 == 0)
+void button_pressed(uint8_t n)
+{
+  switch (n)
   {
-    if (no == false)
-    {
-      synth.noteOn( 1, 64, 100 );
-      synth.noteOn( 1, 68, 100 );
-      synth.noteOn( 1, 71, 100 );
-      no = true;
-    }
-    else
-    {
-      synth.noteOff( 1, 64 );
-      synth.noteOff( 1, 68 );
-      synth.noteOff( 1, 71 );
-      no = false;
-    }
+    case 0:
+      bitSet(refresh, REFRESH_BUT1);
+      browse = (browse + 1) % 3;
+      break;
+    case 1:
+      bitSet(refresh, REFRESH_BUT2);
+      synth_voice_config[channel].patch = (bank << 7) | voice;
+      setSynth(channel);
+      store_voice_setup(0, channel); // written behind, see task_eeprom()
+      store_routing(0); // the MIDI-IN routing of the setup switched to
+      break;
   }
-#endif
 }
 
-//**************************************************************************
-// FUNCTIONS
+// Long presses: button 1 switches to the next setup, button 2 morphs there
+void button_held(uint8_t n)
+{
+  switch (n)
+  {
+    case 0:
+      setup_switch(setup_next(setup_current));
+      break;
+    case 1:
+      setup_morph(setup_next(setup_current), MORPH_UI_MS);
+      break;
+  }
+}
 
-void show_ui(void)
+// Next setup after <n> that can be loaded, <n> if there is none
+uint16_t setup_next(uint16_t n)
 {
-  char voice_name[17];
+  uint16_t i, m, count = setup_count();
 
-  // Show-UI
-  if (voice < 0)
+  for (i = 1; i < count; i++)
   {
-    lcd.show(1, 0, 16, "OFF");
-    lcd.show(1, 18, 2, channel + 1);
+    m = (n + i) % count;
+    if (setup_open(m))
+      return (m);
   }
-  else
+  return (n);
+}
+
+// Switch to setup <n>, only what differs is sent (restore_setup)
+void setup_switch(uint16_t n)
+{
+  morph_stop();
+  if (!restore_setup(n))
+    return;
+  setup_current = n;
+  bitSet(refresh, REFRESH);
+}
+
+// Morph from the current setup to setup <n> (morph_start)
+void setup_morph(uint16_t n, uint16_t ms)
+{
+  if (n == setup_current)
+    return;
+  morph_start(setup_current, n, ms);
+  if (!morph_active)
+    return;
+  setup_current = n;
+  bitSet(refresh, REFRESH);
+}
+
+// Bring up the synth a bit at a time, then run setup morphs
+void task_setup(void)
+{
+  if (boot_state != BOOT_DONE)
+    boot_step();
+  else if (morph_active)
+    morph_step();
+}
+
+// Commit the live setup a byte at a time while nothing else goes on. An
+// EEPROM write takes 3.3ms but runs by itself. A 4ms tick can come ~3ms
+// after the last one (millis() steps by 2 now and then), storage_commit()
+// skips the tick then rather than have EEPROM.write() wait.
+void task_eeprom(void)
+{
+  if (live_pending || live_session)
   {
-    if (channel == 9)
-    {
-      voice = voice % 5;
-      synth_voice_config[channel].patch = uint8_t(pgm_read_byte(&_drum_prog_map[voice]));
-      strcpy_P(voice_name, (char*)pgm_read_word(&(_drum_name[voice])));
-    }
-    else
-    {
-      voiceName(voice_name, bank, synth_voice_config[channel].patch);
-    }
-    lcd.show(1, 0, 16, voice_name);
-    lcd.show(1, 18, 2, channel + 1);
+    if (boot_state == BOOT_DONE && !morph_active && !synth.txPending() && millis() - input_ms >= STORAGE_IDLE_MS)
+      storage_commit();
   }
-
-  refresh = 0;
 }
 
-// Output routine for FluxSynth.
-bool sendMidiByte(byte B)
+void task_ui(void)
 {
-  fluxama.write(B);
-  return true;
+  // show UI
+  if (refresh)
+    show_ui();
 }
 
-void setSynth(uint8_t channel)
+void task_lcd(void)
 {
-  synth.programChange(channel, synth_voice_config[channel].patch & 0x7f, synth_voice_config[channel].patch >> 7);
-  synth.setChannelVolume(channel, synth_voice_config[channel].volume);
-  synth.GM_Volume(channel, synth_voice_config[channel].volume);
-  synth.GM_Pan(channel, synth_voice_config[channel].pan);
-  synth.setReverbSend(channel, synth_voice_config[channel].reverb_send);
-  synth.GM_ReverbSend(channel, synth_voice_config[channel].reverb_send);
-  synth.setChorusSend(channel, synth_voice_config[channel].chorus_send);
-  synth.GM_ChorusSend(channel, synth_voice_config[channel].chorus_send);
-  synth.setBendRange(channel, synth_voice_config[channel].bend_range );
+  lcd_flush(LCD_FLUSH_CHARS);
 }
 
-void setConfig(void)
+// Moved pots, their 7 bit values go to the current channel. Moves while
+// booting are dropped, the setup isn't on the synth yet.
+void task_pots(void)
 {
-  // Global settings
-  synth.setMasterVolume(synth_config.level);
-  synth.GS_MasterVolume(synth_config.level);
-  synth.GS_MasterPan(synth_config.pan);
-  synth.setClippingMode(synth_config.clipping);
-  synth.setMasterTranspose(synth_config.transpose);
+  uint16_t changed, value;
+  uint8_t i;
 
-  // Reverb
-  if (synth_config.reverb_program >= 0)
+  noInterrupts();
+  changed = pot_changed;
+  pot_changed = 0;
+  interrupts();
+  if (boot_state != BOOT_DONE)
+    return;
+
+  for (i = 0; i < MAX_POT; i++)
   {
-    synth.enableReverb(true);
-    synth.setReverb(synth_config.reverb_program, synth_config.reverb_time, synth_config.reverb_feedback, synth_config.reverb_character);
-    synth.setReverbLevel(synth_config.reverb_level);
+    if (!bitRead(changed, i))
+      continue;
+    noInterrupts();
+    value = pot_value[i];
+    interrupts();
+    pot_moved(i, value >> 7);
   }
-  else
-    synth.enableReverb(false);
+}
 
-  // Chorus
-  if (synth_config.chorus_program >= 0)
+void pot_moved(uint8_t n, uint8_t value)
+{
+  switch (n)
   {
-    synth.enableEffects(true);
-    synth.setChorus(synth_config.chorus_program, synth_config.chorus_delay, synth_config.chorus_feedback, synth_config.chorus_rate, synth_config.chorus_depth);
-    synth.setChorusLevel(synth_config.chorus_level);
+    case 0:
+      synth_voice_config[channel].volume = value;
+      synth.setChannelVolume(channel, value);
+      break;
+    case 1:
+      synth_voice_config[channel].reverb_send = value;
+      synth.setReverbSend(channel, value);
+      break;
+    case 2:
+      synth_voice_config[channel].chorus_send = value;
+      synth.setChorusSend(channel, value);
+      break;
+    case 3:
+      synth_config.level = value;
+      synth.setMasterVolume(value);
+      break;
+    default:
+      return;
+  }
+  pot_last = n;
+  pot_last_value = value;
+  bitSet(refresh, REFRESH_POT);
+}
+
+#ifdef PLAY_TEST_CHORD
+void task_test_chord(void)
+{
+  static boolean no = false;
+
+  if (no == false)
+  {
+    synth.noteOn( 1, 64, 100 );
+    synth.noteOn( 1, 68, 100 );
+    synth.noteOn( 1, 71, 100 );
+    no = true;
   }
   else
-    synth.enableEffects(false);
+  {
+    synth.noteOff( 1, 64 );
+    synth.noteOff( 1, 68 );
+    synth.noteOff( 1, 71 );
+    no = false;
+  }
+}
+#endif
+
+#ifdef DEBUG
+// Output statistics, time spent waiting on the Fluxama link should be 0
+// with FLUXAMA_HW_UART
+void task_stats(void)
+{
+  Serial.print(F("TX wait us: "));
+  Serial.print(synth.txWaitTime());
+  Serial.print(F(" stalls: "));
+  Serial.print(synth.txStalls());
+  Serial.print(F(" max queued: "));
+  Serial.print(synth.txHighWater());
+  Serial.print(F(" max note delay us: "));
+  Serial.println(synth.rtMaxWait());
+  task_report();
 }
+#endif
 
-void voiceName(char *buffer, uint8_t bank, uint8_t program)
+// Cooperative scheduler (struct Task). Tasks with period 0 run on every
+// pass, of the periodic and signaled tasks only the first one due runs per
+// pass, so a slow one (LCD, EEPROM) holds up the output and input scan for
+// one run at most. Run times are recorded per task against its budget.
+const char task_name_tx[] PROGMEM = "tx";
+const char task_name_input[] PROGMEM = "input";
+const char task_name_setup[] PROGMEM = "setup";
+const char task_name_eeprom[] PROGMEM = "eeprom";
+const char task_name_ui[] PROGMEM = "ui";
+const char task_name_lcd[] PROGMEM = "lcd";
+const char task_name_pots[] PROGMEM = "pots";
+#ifdef PLAY_TEST_CHORD
+const char task_name_test_chord[] PROGMEM = "chord";
+#endif
+#ifdef DEBUG
+const char task_name_stats[] PROGMEM = "stats";
+#endif
+
+Task tasks[] = {
+  { task_tx, task_name_tx, 0, 700 }, // SoftwareSerial: 320us per byte
+  { task_input, task_name_input, 0, 200 },
+  { task_setup, task_name_setup, 2, 1000 },
+  { task_eeprom, task_name_eeprom, 4, 100 },
+  { task_ui, task_name_ui, 40, 500 },
+  { task_lcd, task_name_lcd, 0, LCD_FLUSH_CHARS * 600 }, // I2C
+  { task_pots, task_name_pots, TASK_EVENT, 300 }, // ADC interrupt
+#ifdef PLAY_TEST_CHORD
+  { task_test_chord, task_name_test_chord, 2000, 500 },
+#endif
+#ifdef DEBUG
+  { task_stats, task_name_stats, 5000, 20000 },
+#endif
+};
+#define TASKS (sizeof(tasks) / sizeof(Task))
+
+void task_signal(uint8_t id)
 {
-  strcpy_P(buffer, (char*)pgm_read_word(&(_voice_name[bank * 128 + program])));
+  tasks[id].signaled = true;
 }
 
-long encoder_move(int8_t dir, int16_t min, int16_t max, long value)
+void task_exec(Task &task)
 {
-  if (value + dir < min)
-    value = min;
-  else if (value + dir > max)
-    value = max;
-  else
-    value += dir;
+  uint32_t us = micros();
 
-  return (value);
+  task.run();
+  us = micros() - us;
+  if (us > task.max_us)
+    task.max_us = us;
+  if (us > task.budget_us)
+    task.overruns++;
+  if (task.runs == 0xFFFF)
+  {
+    task.sum_us /= 2;
+    task.runs /= 2;
+  }
+  task.sum_us += us;
+  task.runs++;
 }
 
-void store_voice_setup(uint8_t n, uint8_t channel)
+void task_run(void)
 {
-  uint8_t v;
+  uint32_t now = millis();
+  bool slot = true; // one periodic/signaled task per pass
+  uint8_t i;
 
-  if (n > max_storage - 1 || channel > 15)
-    return;
+  for (i = 0; i < TASKS; i++)
+  {
+    Task &task = tasks[i];
 
-  // store voice configs
-  EEPROM.put(n * (sizeof(synth_config) + sizeof(synth_voice_config)) + sizeof(synth_config) + channel * sizeof(synth_voice_config), synth_voice_config[channel]);
+    if (task.period_ms == 0)
+      task_exec(task);
+    else if (slot)
+    {
+      if (task.period_ms == TASK_EVENT)
+      {
+        if (!task.signaled)
+          continue;
+        task.signaled = false;
+      }
+      else
+      {
+        if (now - task.last_ms < task.period_ms)
+          continue;
+        task.last_ms = now;
+      }
+      task_exec(task);
+      slot = false;
+    }
+  }
 }
 
-void store_setup(uint8_t n)
+#ifdef DEBUG
+// Per task: max/avg run time since the last report, budget overruns
+void task_report(void)
 {
-  uint8_t v;
+  uint8_t i;
 
-  if (n > max_storage - 1)
-    return;
+  for (i = 0; i < TASKS; i++)
+  {
+    Task &task = tasks[i];
 
-  // store global config
-  EEPROM.put(n * (sizeof(synth_config) + sizeof(synth_voice_config)), synth_config);
-  for (v = 0; v < 16; v++)
+    Serial.print((const __FlashStringHelper*)task.name);
+    Serial.print(F(" max us: "));
+    Serial.print(task.max_us);
+    Serial.print(F(" avg us: "));
+    Serial.print(task.runs ? task.sum_us / task.runs : 0);
+    Serial.print(F(" over budget: "));
+    Serial.println(task.overruns);
+    task.max_us = 0;
+    task.sum_us = 0;
+    task.runs = 0;
+  }
+}
+#endif
+
+// Each widget is redrawn when one of the REFRESH_* bits it depends on
+// is set, bit REFRESH redraws all of them
+void show_ui(void)
+{
+  char voice_name[17];
+  uint8_t hold = 0;
+
+  // Voice, the name lookup waits until a spin ends
+  if (uint16_t(uint16_t(millis()) - encoder_ms[0]) < UI_SPIN_HOLD_MS)
+    hold = refresh & (bit(REFRESH) | bit(REFRESH_ENC1) | bit(REFRESH_ENC2));
+  else if (refresh & (bit(REFRESH) | bit(REFRESH_ENC1) | bit(REFRESH_ENC2)))
   {
-    // store voice configs
-    store_voice_setup(n, v);
+    if (voice < 0)
+      lcd_show(1, 0, 16, "OFF");
+    else
+    {
+      if (channel == 9)
+      {
+        voice = voice % 5;
+        synth_voice_config[channel].patch = uint8_t(pgm_read_byte(&_drum_prog_map[voice]));
+        strcpy_P(voice_name, (char*)pgm_read_word(&(_drum_name[voice])));
+      }
+      else
+      {
+        voiceName(voice_name, bank, synth_voice_config[channel].patch);
+      }
+      lcd_show(1, 0, 16, voice_name);
+    }
+  }
+
+  // Browse mode
+  if (refresh & (bit(REFRESH) | bit(REFRESH_BUT1)))
+    lcd_show(1, 16, 1, browse == BROWSE_FAMILY ? "F" : browse == BROWSE_LETTER ? "A" : "");
+
+  // Channel
+  if (refresh & (bit(REFRESH) | bit(REFRESH_ENC2)))
+    lcd_show(1, 18, 2, channel + 1);
+
+  // Last moved pot
+  if (pot_last != 0xff && (refresh & (bit(REFRESH) | bit(REFRESH_POT))))
+  {
+    lcd_show(2, 0, 7, pot_last == 0 ? "Volume" : pot_last == 1 ? "Reverb" : pot_last == 2 ? "Chorus" : "Master");
+    lcd_show(2, 7, 3, pot_last_value);
+  }
+
+  // Setup
+  if (refresh & bit(REFRESH))
+  {
+    lcd_show(3, 0, 6, "Setup");
+    if (setup_current == 0)
+      lcd_show(3, 6, 5, "live");
+    else
+      lcd_show(3, 6, 5, long(setup_current));
   }
+
+  refresh = hold;
 }
-void restore_setup(uint8_t n)
+
+void lcd_clear(void)
 {
-  uint8_t v;
+  lcd.clear();
+  memset(lcd_fb, ' ', sizeof(lcd_fb));
+  memset(lcd_dirty, 0, sizeof(lcd_dirty));
+  lcd_pending = 0;
+}
 
-  if (n > max_storage - 1)
-    return;
+// Write a left aligned, blank padded field to the framebuffer, only
+// cells that change are marked for lcd_flush()
+void lcd_show(uint8_t y, uint8_t x, uint8_t size, const char *str)
+{
+  char c;
 
-  // restore global config
-  EEPROM.get(n * (sizeof(synth_config) + sizeof(synth_voice_config)), synth_config);
-  setConfig();
-  for (v = 0; v < 16; v++)
+  for (; size && x < LCD_CHARS; size--, x++)
   {
-    // restore voice configs
-    EEPROM.get(n * (sizeof(synth_config) + sizeof(synth_voice_config)) + sizeof(synth_config) + v * sizeof(synth_voice_config), synth_voice_config[v]);
+    c = *str ? *str++ : ' ';
+    if (lcd_fb[y][x] == c)
+      continue;
+    lcd_fb[y][x] = c;
+    if (!bitRead(lcd_dirty[y][x >> 3], x & 7))
+    {
+      bitSet(lcd_dirty[y][x >> 3], x & 7);
+      lcd_pending++;
+    }
   }
-  synth.restartEffects();
-  voice = synth_voice_config[channel].patch;
 }
 
-#ifdef INIT_STORAGE
-void init_storage(void)
+void lcd_show(uint8_t y, uint8_t x, uint8_t size, long num)
+{
+  char buf[12];
+
+  lcd_show(y, x, size, ltoa(num, buf, 10));
+}
+
+// Send up to <max> changed cells to the display. Adjacent cells form a
+// run that needs only one cursor command, the display advances itself.
+void lcd_flush(uint8_t max)
 {
-  lcd.show(1, 0, 20, "Init Storage");
+  uint8_t x, y;
+  bool run;
 
-  for (uint16_t i = 0 ; i < EEPROM.length() ; i++)
+  for (y = 0; y < LCD_LINES && lcd_pending; y++)
   {
-    lcd.show(2, 0, 4, i);
-    EEPROM.write(i, 0);
+    run = false;
+    for (x = 0; x < LCD_CHARS; x++)
+    {
+      if (!bitRead(lcd_dirty[y][x >> 3], x & 7))
+      {
+        run = false;
+        continue;
+      }
+      if (max-- == 0)
+        return;
+      if (!run)
+      {
+        lcd.setCursor(x, y);
+        run = true;
+      }
+      lcd.write(lcd_fb[y][x]);
+      bitClear(lcd_dirty[y][x >> 3], x & 7);
+      lcd_pending--;
+    }
   }
+}
+
+// Output routine for FluxSynth.
+bool sendMidiByte(byte B)
+{
+#ifdef FLUXAMA_HW_UART
+  // Only used without the queue, the UDRE interrupt does the rest
+  while (!(FLUXAMA_UCSRA & _BV(FLUXAMA_UDRE)))
+    ;
+  FLUXAMA_UDR = B;
+#else
+  fluxama.write(B);
+#endif
+  return true;
+}
+
+// MIDI-IN setup, RX only (8N1)
+void midiInBegin(void)
+{
+  FLUXAMA_MIDI_IN_UBRR = (F_CPU / 16 / FLUXAMA_BAUD) - 1;
+  FLUXAMA_MIDI_IN_UCSRA = 0;
+  FLUXAMA_MIDI_IN_UCSRC = _BV(UCSZ01) | _BV(UCSZ00);
+  FLUXAMA_MIDI_IN_UCSRB = _BV(RXEN0) | _BV(RXCIE0);
+}
 
-  lcd.show(1, 0, 20, "");
-  lcd.show(2, 0, 20, "");
+// MIDI-IN byte received: hand it to the thru engine right away,
+// with FLUXAMA_HW_UART it goes out after the current message.
+ISR(FLUXAMA_MIDI_IN_RX_vect)
+{
+  bool bad = FLUXAMA_MIDI_IN_UCSRA & _BV(FE0);
+  byte b = FLUXAMA_MIDI_IN_UDR;
+  if (!bad)
+    synth.thruByte(b);
+}
+
+// Encoder/button sampling: the pins have no pin change interrupts on the
+// MEGA2560 (except 10-12), so they are read every millisecond from the
+// Timer0 compare interrupt, next to the millis() overflow one.
+void inputBegin(void)
+{
+  uint8_t i, pin;
+
+  for (i = 0; i < MAX_ENCODER; i++)
+  {
+    InputEncoder &e = encoders[i];
+
+    pin = pgm_read_byte(&encoder_pins[i][0]);
+    pinMode(pin, INPUT_PULLUP);
+    e.pin_a = portInputRegister(digitalPinToPort(pin));
+    e.mask_a = digitalPinToBitMask(pin);
+    pin = pgm_read_byte(&encoder_pins[i][1]);
+    pinMode(pin, INPUT_PULLUP);
+    e.pin_b = portInputRegister(digitalPinToPort(pin));
+    e.mask_b = digitalPinToBitMask(pin);
+    pin = pgm_read_byte(&encoder_pins[i][2]);
+    pinMode(pin, INPUT_PULLUP);
+    e.pin_button = portInputRegister(digitalPinToPort(pin));
+    e.mask_button = digitalPinToBitMask(pin);
+    e.state = ((*e.pin_a & e.mask_a) ? 2 : 0) | ((*e.pin_b & e.mask_b) ? 1 : 0);
+    e.pressed = !(*e.pin_button & e.mask_button);
+  }
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+}
+
+// Called from the interrupt only
+bool input_push(uint8_t type, int8_t value, uint16_t ms)
+{
+  uint8_t head = input_head;
+
+  if (uint8_t(head - input_tail) >= INPUT_QUEUE_SIZE)
+    return (false);
+  input_queue[head & (INPUT_QUEUE_SIZE - 1)].type = type;
+  input_queue[head & (INPUT_QUEUE_SIZE - 1)].value = value;
+  input_queue[head & (INPUT_QUEUE_SIZE - 1)].ms = ms;
+  input_head = head + 1;
+  return (true);
+}
+
+bool input_pop(InputEvent &ev)
+{
+  uint8_t tail = input_tail;
+
+  if (tail == input_head)
+    return (false);
+  ev = input_queue[tail & (INPUT_QUEUE_SIZE - 1)];
+  input_tail = tail + 1;
+  return (true);
+}
+
+// Pot scanning: each conversion complete interrupt starts the next one,
+// POT_OVERSAMPLE per pot (plus one thrown away after switching over) at
+// 104us (ADC clock 125kHz), so nothing waits for analogRead().
+void potsBegin(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < MAX_POT; i++)
+  {
+    pinMode(pgm_read_byte(&pot_pins[i]), INPUT);
+    pot_filter[i] = -1;
+  }
+  pot_select(0);
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  ADCSRA |= _BV(ADSC);
+}
+
+void pot_select(uint8_t n)
+{
+  uint8_t ch = pgm_read_byte(&pot_pins[n]) - A0;
+
+  pot_channel = n;
+  ADMUX = _BV(REFS0) | (ch & 0x07); // AVcc reference
+  if (ch & 0x08)
+    ADCSRB |= _BV(MUX5);
+  else
+    ADCSRB &= ~_BV(MUX5);
+}
+
+// Sum up a pot, filter the sum (14 bits) and publish it when it has moved
+// more than POT_HYSTERESIS, or reached an end. The position at power-on
+// isn't a move, the setup stays as loaded.
+ISR(ADC_vect)
+{
+  uint16_t v = ADC;
+  int16_t f, d;
+  bool first;
+
+  if (pot_sample++ > 0)
+    pot_sum += v;
+  if (pot_sample > POT_OVERSAMPLE)
+  {
+    f = pot_filter[pot_channel];
+    v = (uint32_t(pot_sum) << 4) / POT_OVERSAMPLE; // 10 bits -> 14 bits
+    first = f < 0;
+    if (first)
+      f = v;
+    else
+      f += (int16_t(v) - f) >> 2;
+    pot_filter[pot_channel] = f;
+
+    if (f < POT_HYSTERESIS)
+      f = 0;
+    else if (f > 0x3fff - POT_HYSTERESIS)
+      f = 0x3fff;
+    d = f - int16_t(pot_value[pot_channel]);
+    if (first)
+      pot_value[pot_channel] = f; // where the pot is now, clamped like the rest
+    else if (d >= POT_HYSTERESIS || d <= -POT_HYSTERESIS || (d && (f == 0 || f == 0x3fff)))
+    {
+      pot_value[pot_channel] = f;
+      bitSet(pot_changed, pot_channel);
+      task_signal(TASK_POTS);
+    }
+
+    pot_sum = 0;
+    pot_sample = 0;
+    pot_select(pot_channel + 1 < MAX_POT ? pot_channel + 1 : 0);
+  }
+  ADCSRA |= _BV(ADSC);
+}
+
+// Quadrature decoder: old state * 4 + new state -> step
+const int8_t quadrature[16] PROGMEM = { 0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0 };
+
+// Sample all encoders and buttons. Nothing gets lost when the queue is
+// full: turns add up in delta, a button change is taken over only once
+// its event is queued.
+ISR(TIMER0_COMPA_vect)
+{
+  uint16_t ms = millis();
+  uint8_t i, s;
+  bool b;
+
+  for (i = 0; i < MAX_ENCODER; i++)
+  {
+    InputEncoder &e = encoders[i];
+
+    s = ((*e.pin_a & e.mask_a) ? 2 : 0) | ((*e.pin_b & e.mask_b) ? 1 : 0);
+    e.quarter += int8_t(pgm_read_byte(&quadrature[(e.state << 2) | s]));
+    e.state = s;
+    if (e.quarter >= ENCODER_STEPS)
+    {
+      e.quarter -= ENCODER_STEPS;
+      if (e.delta < 127)
+        e.delta++;
+    }
+    else if (e.quarter <= -ENCODER_STEPS)
+    {
+      e.quarter += ENCODER_STEPS;
+      if (e.delta > -127)
+        e.delta--;
+    }
+    if (e.delta && input_push(INPUT_TURN | i, e.delta, ms))
+      e.delta = 0;
+
+    b = !(*e.pin_button & e.mask_button);
+    if (b == e.pressed)
+      e.bounce = 0;
+    else if (++e.bounce >= DEBOUNCE_INTERVAL_MS && input_push((b ? INPUT_PRESS : INPUT_RELEASE) | i, 0, ms))
+    {
+      e.pressed = b;
+      e.bounce = 0;
+    }
+  }
+}
+
+#ifdef FLUXAMA_HW_UART
+// USART setup, TX only (8N1)
+void fluxamaBegin(void)
+{
+  FLUXAMA_UBRR = (F_CPU / 16 / FLUXAMA_BAUD) - 1;
+  FLUXAMA_UCSRA = 0;
+  FLUXAMA_UCSRC = FLUXAMA_8N1;
+  FLUXAMA_UCSRB = _BV(FLUXAMA_TXEN);
+}
+
+// Called by FluxSynth when data was queued: let the interrupt fetch it
+void fluxamaKick(void)
+{
+  FLUXAMA_UCSRB |= _BV(FLUXAMA_UDRIE);
+}
+
+// Data register empty: send the next queued byte, or sleep until kicked
+ISR(FLUXAMA_UDRE_vect)
+{
+  int b = synth.txNext();
+  if (b < 0)
+    FLUXAMA_UCSRB &= ~_BV(FLUXAMA_UDRIE);
+  else
+    FLUXAMA_UDR = b;
+}
+#endif
+
+// Boot state machine, one step per call, as long as there's room in the
+// output queue. Only GS_Reset is sent: it covers GM_Reset, and midiReset
+// isn't needed for a setup that's sent in full anyway.
+void boot_step(void)
+{
+  if (synth.settling() || synth.txFree() < BOOT_TX_FREE)
+    return;
+
+  switch (boot_state)
+  {
+    case BOOT_RESET:
+      synth.GS_Reset();
+      break;
+    case BOOT_POSTPROC:
+      synth.postprocGeneralMidi(false);  // Surround + EQ on GM
+      synth.postprocReverbChorus(false); // Surround + EQ on Reverb and Chorus
+      synth.surroundMonoIn(false);
+      break;
+    case BOOT_LOAD:
+#ifndef INIT_STORAGE
+      load_setup(0);
+#endif
+      boot_channel = 0;
+      break;
+    case BOOT_SOUNDS:
+      setSynthSound(boot_channel);
+      if (++boot_channel < 16)
+        return;
+      break;
+    case BOOT_GLOBALS:
+      setGlobals();
+      break;
+    case BOOT_READY:
+      if (synth.txPending())
+        return;
+      boot_ready_ms = millis();
+#ifdef DEBUG
+      Serial.print(F("Ready to play after ms: "));
+      Serial.println(boot_ready_ms);
+#endif
+      boot_channel = 0;
+      break;
+    case BOOT_DETAILS:
+      setSynthDetails(boot_channel);
+      applied_voice[boot_channel] = synth_voice_config[boot_channel];
+      if (++boot_channel < 16)
+        return;
+      break;
+    case BOOT_EFFECTS:
+      setEffects();
+      synth.restartEffects();
+      synth.enableEffects(effect_flags(synth_config)); // the restart enables all
+      applied_config = synth_config;
+      applied_valid = true;
+      break;
+  }
+  boot_state++;
+}
+
+void setSynth(uint8_t channel)
+{
+  setSynthSound(channel);
+  setSynthDetails(channel);
+  applied_voice[channel] = synth_voice_config[channel];
+}
+
+// What a note needs to be heard right
+void setSynthSound(uint8_t channel)
+{
+  synth.programChange(channel, synth_voice_config[channel].patch & 0x7f, synth_voice_config[channel].patch >> 7);
+  synth.setChannelVolume(channel, synth_voice_config[channel].volume);
+  synth.GM_Volume(channel, synth_voice_config[channel].volume);
+}
+
+void setSynthDetails(uint8_t channel)
+{
+  synth.GM_Pan(channel, synth_voice_config[channel].pan);
+  synth.setReverbSend(channel, synth_voice_config[channel].reverb_send);
+  synth.GM_ReverbSend(channel, synth_voice_config[channel].reverb_send);
+  synth.setChorusSend(channel, synth_voice_config[channel].chorus_send);
+  synth.GM_ChorusSend(channel, synth_voice_config[channel].chorus_send);
+  synth.setBendRange(channel, synth_voice_config[channel].bend_range );
+}
+
+void setConfig(void)
+{
+  setGlobals();
+  setEffects();
+}
+
+void setGlobals(void)
+{
+  // Global settings
+  synth.setMasterVolume(synth_config.level);
+  synth.GS_MasterVolume(synth_config.level);
+  synth.GS_MasterPan(synth_config.pan);
+  synth.setClippingMode(synth_config.clipping);
+  synth.setMasterTranspose(synth_config.transpose);
+}
+
+// Effect enable flags (EF_...) for a setup. The chorus has no flag of its
+// own, it is switched off through its level.
+uint8_t effect_flags(const SynthGlobal &c)
+{
+  uint8_t flags = 0;
+
+  if (c.reverb_program >= 0)
+    flags |= EF_REVERB;
+#ifdef EXTENDED_SETUP
+  if (c.surround_postproc & 0x01)
+    flags |= EF_SURROUND;
+  if (c.eq_bass || c.eq_lowmid || c.eq_highmid || c.eq_high)
+    flags |= EF_EQ_4BAND;
+#endif
+  return (flags);
+}
+
+void setEffects(void)
+{
+  synth.enableEffects(effect_flags(synth_config));
+
+  // Reverb
+  if (synth_config.reverb_program >= 0)
+  {
+    synth.setReverb(synth_config.reverb_program, synth_config.reverb_time, synth_config.reverb_feedback, synth_config.reverb_character);
+    synth.setReverbLevel(synth_config.reverb_level);
+  }
+
+  // Chorus
+  if (synth_config.chorus_program >= 0)
+  {
+    synth.setChorus(synth_config.chorus_program, synth_config.chorus_delay, synth_config.chorus_feedback, synth_config.chorus_rate, synth_config.chorus_depth);
+    synth.setChorusLevel(synth_config.chorus_level);
+  }
+  else
+    synth.setChorusLevel(0);
+}
+
+uint8_t voice_nibble(const uint8_t *table, uint8_t n)
+{
+  return ((pgm_read_byte(&table[n >> 1]) >> ((n & 1) << 2)) & 0x0f);
+}
+
+uint16_t voice_text_pos(uint8_t n)
+{
+  uint16_t pos;
+  uint8_t i;
+
+  pos = pgm_read_word(&_voice_group[n / VOICE_GROUP]);
+  for (i = n & ~(VOICE_GROUP - 1); i != n; i++)
+    pos += voice_nibble(_voice_length, i);
+  return (pos);
+}
+
+// First letter of a voice name, 0 for A
+uint8_t voice_letter(uint8_t n)
+{
+  uint8_t c;
+
+  c = pgm_read_byte(&_voice_text[voice_text_pos(n)]);
+  if (c >= VOICE_WORD)
+    c = pgm_read_byte(&_voice_words[pgm_read_word(&_voice_word_start[c - VOICE_WORD])]);
+  return (c - 'A');
+}
+
+// Jump <dir> families or first letters (browse) from <program> of the
+// current bank, empty ones are skipped
+int8_t browse_jump(int8_t program, int8_t dir)
+{
+  uint8_t b = bank == PATCH_BANK1 ? 1 : 0;
+  uint8_t n = b * 128 + program;
+  uint8_t i, first;
+
+  if (browse == BROWSE_FAMILY)
+  {
+    i = voice_nibble(_voice_family, n);
+    for (; dir != 0; dir += dir > 0 ? -1 : 1)
+    {
+      do
+      {
+        i = (i + (dir > 0 ? 1 : VOICE_FAMILIES - 1)) % VOICE_FAMILIES;
+        first = pgm_read_byte(&_voice_family_first[b][i]);
+      } while (first == VOICE_NO_PROGRAM);
+      program = first;
+    }
+  }
+  else
+  {
+    i = voice_letter(n);
+    for (; dir != 0; dir += dir > 0 ? -1 : 1)
+    {
+      do
+        i = (i + (dir > 0 ? 1 : 25)) % 26;
+      while (pgm_read_byte(&_voice_letter[b][i]) == pgm_read_byte(&_voice_letter[b][i + 1]));
+    }
+    program = pgm_read_byte(&_voice_alpha[b][pgm_read_byte(&_voice_letter[b][i])]);
+  }
+  return (program);
+}
+
+// Decode a voice name from FluxVoiceNames.h to <buffer> (17 bytes). The
+// names of a group are counted from the group start, so it's bounded by
+// VOICE_GROUP reads plus the name.
+void voiceName(char *buffer, uint8_t bank, uint8_t program)
+{
+  uint8_t n = (bank == PATCH_BANK1 ? 128 : 0) + (program & 0x7f);
+  uint16_t pos, w, end;
+  uint8_t i, codes, c;
+
+  pos = voice_text_pos(n);
+  codes = voice_nibble(_voice_length, n);
+
+  for (i = 0; i < codes; i++)
+  {
+    c = pgm_read_byte(&_voice_text[pos + i]);
+    if (c < VOICE_WORD)
+      *buffer++ = c;
+    else
+    {
+      w = pgm_read_word(&_voice_word_start[c - VOICE_WORD]);
+      end = pgm_read_word(&_voice_word_start[c - VOICE_WORD + 1]);
+      while (w < end)
+        *buffer++ = pgm_read_byte(&_voice_words[w++]);
+    }
+  }
+  *buffer = '\0';
+}
+
+#ifdef DEBUG
+// Decode time of all voice names, against strcpy_P of as many characters
+// (what the plain string table took). micros() counts in 4 us steps, so
+// only the sums are told.
+void voice_name_bench(void)
+{
+  char name[17];
+  uint8_t length[VOICE_NAMES];
+  uint16_t i;
+  uint32_t t, t_ref;
+
+  t = micros();
+  for (i = 0; i < VOICE_NAMES; i++)
+  {
+    voiceName(name, i < 128 ? PATCH_BANK0 : PATCH_BANK1, i & 0x7f);
+    length[i] = strlen(name);
+  }
+  t = micros() - t;
+  t_ref = micros();
+  for (i = 0; i < VOICE_NAMES; i++)
+  {
+    strncpy_P(name, _voice_words, length[i]);
+    name[length[i]] = '\0';
+  }
+  t_ref = micros() - t_ref;
+  Serial.print(F("Voice names us: "));
+  Serial.print(t);
+  Serial.print(F(", strcpy_P us: "));
+  Serial.println(t_ref);
+}
+#endif
+
+// Move <value> by <dir> detents within min..max, faster the shorter the
+// <interval> between detents, as far as encoder_curve allows for the range
+long encoder_move(int8_t dir, uint16_t interval, int16_t min, int16_t max, long value)
+{
+  uint8_t i, steps;
+
+  for (i = 0; i < sizeof(encoder_curve) / 2 - 1; i++)
+    if (max - min <= pgm_read_byte(&encoder_curve[i][0]))
+      break;
+  steps = pgm_read_byte(&encoder_curve[i][1]);
+  if (interval >= ENCODER_SLOW_MS)
+    steps = 1;
+  else if (interval > ENCODER_FAST_MS)
+    steps = 1 + (steps - 1) * (ENCODER_SLOW_MS - interval) / (ENCODER_SLOW_MS - ENCODER_FAST_MS);
+  value += long(dir) * steps;
+
+  if (value < min)
+    value = min;
+  else if (value > max)
+    value = max;
+
+  return (value);
+}
+
+void store_voice_setup(uint16_t n, uint8_t channel)
+{
+  if (n >= setup_count() || channel > 15)
+    return;
+
+  // store voice configs
+  if (!setup_open(n))
+    setup_defaults(preset_image);
+  setup_put(n, SETUP_VOICE_OFFSET + channel * sizeof(SynthVoice), &synth_voice_config[channel], sizeof(SynthVoice));
+  setup_commit(n);
+}
+
+void store_routing(uint16_t n)
+{
+  if (n >= setup_count())
+    return;
+
+  if (!setup_open(n))
+    setup_defaults(preset_image);
+  setup_put(n, SETUP_ROUTING_OFFSET, &synth_routing, sizeof(FluxRouting));
+  setup_commit(n);
+}
+
+void store_setup(uint16_t n)
+{
+  uint8_t v;
+
+  if (n >= setup_count())
+    return;
+
+  // store global config
+  setup_put(n, 0, &synth_config, sizeof(SynthGlobal));
+  for (v = 0; v < 16; v++)
+  {
+    // store voice configs
+    setup_put(n, SETUP_VOICE_OFFSET + v * sizeof(SynthVoice), &synth_voice_config[v], sizeof(SynthVoice));
+  }
+  setup_put(n, SETUP_ROUTING_OFFSET, &synth_routing, sizeof(FluxRouting));
+  setup_commit(n);
+}
+
+// Setup data access. Setup 0 is the live cache, the others are unpacked
+// to preset_image by setup_open() and packed again by setup_commit().
+// Setups 1.. are in EEPROM, those from max_storage on in the setup
+// library (SETUP_LIBRARY_SD).
+uint16_t setup_count(void)
+{
+#ifdef SETUP_LIBRARY_SD
+  if (library_ok)
+    return (max_storage + library.slots());
+#endif
+  return (max_storage);
+}
+
+bool setup_open(uint16_t n)
+{
+  if (n == 0)
+    return (true);
+#ifdef SETUP_LIBRARY_SD
+  if (n >= max_storage)
+    return (library_read(n - max_storage, preset_image));
+#endif
+  return (preset_read(n, preset_image));
+}
+
+void setup_commit(uint16_t n)
+{
+  if (n == 0)
+    return;
+#ifdef SETUP_LIBRARY_SD
+  if (n >= max_storage)
+  {
+    library_write(n - max_storage, preset_image);
+    return;
+  }
+#endif
+  preset_write(n, preset_image);
+}
+
+void setup_put(uint16_t n, uint16_t offset, const void *data, uint16_t size)
+{
+  if (n == 0)
+    storage_put(offset, data, size);
+  else
+    memcpy(&preset_image[offset], data, size);
+}
+
+// Current setup to a setup image and back, only the MIDI-IN routing is
+// applied
+void setup_to_image(uint8_t *image)
+{
+  memcpy(image, &synth_config, sizeof(SynthGlobal));
+  memcpy(&image[SETUP_VOICE_OFFSET], synth_voice_config, sizeof(SynthVoice) * 16);
+  memcpy(&image[SETUP_ROUTING_OFFSET], &synth_routing, sizeof(FluxRouting));
+}
+
+void setup_from_image(const uint8_t *image)
+{
+  memcpy(&synth_config, image, sizeof(SynthGlobal));
+  memcpy(synth_voice_config, &image[SETUP_VOICE_OFFSET], sizeof(SynthVoice) * 16);
+  memcpy(&synth_routing, &image[SETUP_ROUTING_OFFSET], sizeof(FluxRouting));
+  synth.setThruRouting(synth_routing);
+  voice = synth_voice_config[channel].patch;
+  bitSet(refresh, REFRESH_ENC1); // voice name may have changed
+}
+
+// Setup image with all defaults, as packing leaves them out
+void setup_defaults(uint8_t *image)
+{
+  SynthGlobal global;
+  SynthVoice voice;
+  FluxRouting routing;
+  uint8_t v;
+
+  memset(&routing, 0, sizeof(routing));
+  memcpy(image, &global, sizeof(SynthGlobal));
+  for (v = 0; v < 16; v++)
+    memcpy(&image[SETUP_VOICE_OFFSET + v * sizeof(SynthVoice)], &voice, sizeof(SynthVoice));
+  memcpy(&image[SETUP_ROUTING_OFFSET], &routing, sizeof(FluxRouting));
+}
+
+//
+// Packed setups
+//
+
+void preset_put_bits(uint8_t value, uint8_t bits)
+{
+  uint8_t *p;
+
+  while (bits--)
+  {
+    p = &preset_buf[PRESET_HEADER + (preset_bit >> 3)];
+    if (value & (1 << bits))
+      *p |= 0x80 >> (preset_bit & 7);
+    else
+      *p &= ~(0x80 >> (preset_bit & 7));
+    preset_bit++;
+  }
+}
+
+uint8_t preset_get_bits(uint8_t bits)
+{
+  uint8_t value = 0;
+
+  while (bits--)
+  {
+    value <<= 1;
+    if (preset_buf[PRESET_HEADER + (preset_bit >> 3)] & (0x80 >> (preset_bit & 7)))
+      value |= 1;
+    preset_bit++;
+  }
+  return (value);
+}
+
+// Pack or unpack <count> structs of <size> bytes at <offset> of the setup
+// image. Each one takes a bit, set if it isn't all defaults. Then a mode
+// bit: either all fields follow, or each field has a bit, set if it's
+// followed by a value that isn't the default. Packing picks the shorter.
+void preset_group(bool pack, uint8_t *image, const uint8_t *defaults, uint16_t offset, uint8_t count, uint8_t size, const uint8_t (*fields)[2], uint8_t nfields)
+{
+  uint8_t i, f, at, bits, value;
+  uint16_t all, changed;
+  bool used, sparse, put;
+
+  for (i = 0; i < count; i++, offset += size)
+  {
+    if (pack)
+    {
+      all = 0;
+      changed = nfields;
+      for (f = 0; f < nfields; f++)
+      {
+        at = pgm_read_byte(&fields[f][0]);
+        bits = pgm_read_byte(&fields[f][1]) & ~PRESET_SIGNED;
+        all += bits;
+        if (image[offset + at] != defaults[offset + at])
+          changed += bits;
+      }
+      used = changed > nfields;
+      sparse = changed < all;
+      preset_put_bits(used, 1);
+      if (used)
+        preset_put_bits(sparse, 1);
+    }
+    else
+    {
+      used = preset_get_bits(1);
+      sparse = used && preset_get_bits(1);
+    }
+    if (!used)
+      continue;
+    for (f = 0; f < nfields; f++)
+    {
+      at = pgm_read_byte(&fields[f][0]);
+      bits = pgm_read_byte(&fields[f][1]);
+      if (sparse)
+      {
+        if (pack)
+        {
+          put = image[offset + at] != defaults[offset + at];
+          preset_put_bits(put, 1);
+        }
+        else
+          put = preset_get_bits(1);
+        if (!put)
+          continue;
+      }
+      if (pack)
+        preset_put_bits(image[offset + at], bits & ~PRESET_SIGNED);
+      else
+      {
+        value = preset_get_bits(bits & ~PRESET_SIGNED);
+        if ((bits & PRESET_SIGNED) && (value & (1 << ((bits & ~PRESET_SIGNED) - 1))))
+          value |= 0xff << (bits & ~PRESET_SIGNED); // sign extend
+        image[offset + at] = value;
+      }
+    }
+  }
+}
+
+// Pack a setup image to preset_buf (after the header) or unpack it,
+// returns the packed length in bytes
+uint8_t preset_pack(bool pack, uint8_t *image)
+{
+  uint8_t defaults[SETUP_SIZE];
+
+  setup_defaults(defaults);
+  if (!pack)
+    memcpy(image, defaults, SETUP_SIZE);
+  preset_bit = 0;
+  preset_group(pack, image, defaults, 0, 1, sizeof(SynthGlobal), preset_global_fields, sizeof(preset_global_fields) / 2);
+  preset_group(pack, image, defaults, SETUP_VOICE_OFFSET, 16, sizeof(SynthVoice), preset_voice_fields, sizeof(preset_voice_fields) / 2);
+  preset_group(pack, image, defaults, SETUP_ROUTING_OFFSET, 1, offsetof(FluxRouting, zone), preset_routing_fields, sizeof(preset_routing_fields) / 2);
+  preset_group(pack, image, defaults, SETUP_ROUTING_OFFSET + offsetof(FluxRouting, zone), ROUTE_MAX_ZONES, sizeof(FluxZone), preset_zone_fields, sizeof(preset_zone_fields) / 2);
+  return ((preset_bit + 7) >> 3);
+}
+
+uint16_t preset_block_addr(uint8_t block)
+{
+  return (PRESET_BLOCKS_ADDR + block * PRESET_BLOCK_SIZE);
+}
+
+// EEPROM address of byte <j> of the data in the blocks of <list>
+uint16_t preset_data_addr(const uint8_t *list, uint16_t j)
+{
+  return (preset_block_addr(list[j / PRESET_BLOCK_DATA]) + 1 + j % PRESET_BLOCK_DATA);
+}
+
+uint16_t preset_crc(uint8_t n, uint16_t length)
+{
+  uint16_t j, crc = 0xffff;
+
+  crc = crc16_update(crc, preset_format);
+  crc = crc16_update(crc, n);
+  for (j = 0; j < length; j++)
+    if (j < PH_CRC || j >= PRESET_HEADER)
+      crc = crc16_update(crc, preset_buf[j]);
+  return (crc);
+}
+
+// Read setup <n> to preset_buf, true if it's there in the current format
+// (any version) and passes the CRC. <list> gets its blocks.
+bool preset_locate(uint8_t n, uint8_t *list, uint8_t &blocks)
+{
+  uint8_t i;
+  uint16_t j, length, crc;
+
+  list[0] = EEPROM.read(PRESET_DIR_ADDR + n - 1);
+  if (list[0] >= PRESET_BLOCKS)
+    return (false);
+  for (j = 0; j < PRESET_HEADER; j++)
+    preset_buf[j] = EEPROM.read(preset_data_addr(list, j));
+  length = PRESET_HEADER + preset_buf[PH_LENGTH];
+  blocks = (length + PRESET_BLOCK_DATA - 1) / PRESET_BLOCK_DATA;
+  if (blocks > PRESET_MAX_BLOCKS)
+    return (false);
+  for (i = 1; i < blocks; i++)
+  {
+    list[i] = EEPROM.read(preset_block_addr(list[i - 1]));
+    if (list[i] >= PRESET_BLOCKS)
+      return (false);
+  }
+  for (j = PRESET_HEADER; j < length; j++)
+    preset_buf[j] = EEPROM.read(preset_data_addr(list, j));
+  crc = preset_crc(n, length);
+  return (preset_buf[PH_CRC] == (crc >> 8) && preset_buf[PH_CRC + 1] == (crc & 0xff));
+}
+
+// Unpack setup <n> to <image>. False if it was never stored (since the
+// last format), is from another format version or doesn't pass the CRC.
+bool preset_read(uint8_t n, uint8_t *image)
+{
+  uint8_t list[PRESET_MAX_BLOCKS];
+  uint8_t blocks;
+
+  if (!preset_locate(n, list, blocks))
+  {
+#ifdef DEBUG
+    if (EEPROM.read(PRESET_DIR_ADDR + n - 1) < PRESET_BLOCKS)
+    {
+      Serial.print(F("Setup corrupt: "));
+      Serial.println(n);
+    }
+#endif
+    return (false);
+  }
+  if (preset_buf[PH_VERSION] != PRESET_LAYOUT)
+  {
+#ifdef DEBUG
+    Serial.print(F("Setup from another version: "));
+    Serial.println(n);
+#endif
+    return (false);
+  }
+  preset_pack(false, image);
+  return (true);
+}
+
+// Pack <image> and store it as setup <n>. The new blocks are written
+// before the directory entry is switched over to them, so a power loss
+// keeps the old setup. Only when there aren't enough free blocks, the
+// old ones are reused.
+bool preset_write(uint8_t n, uint8_t *image)
+{
+  uint8_t list[PRESET_MAX_BLOCKS], old_list[PRESET_MAX_BLOCKS];
+  uint8_t blocks, old_blocks = 0, i, b;
+  uint16_t j, length, crc;
+
+  if (!preset_locate(n, old_list, old_blocks))
+    old_blocks = 0;
+  memset(preset_buf, 0, sizeof(preset_buf));
+  preset_buf[PH_LENGTH] = preset_pack(true, image);
+  length = PRESET_HEADER + preset_buf[PH_LENGTH];
+  blocks = (length + PRESET_BLOCK_DATA - 1) / PRESET_BLOCK_DATA;
+
+  for (i = 0, b = 0; i < blocks && b < PRESET_BLOCKS; b++)
+    if (!bitRead(preset_used[b >> 3], b & 7))
+      list[i++] = b;
+  for (j = 0; i < blocks && j < old_blocks; j++)
+    list[i++] = old_list[j];
+  if (i < blocks)
+  {
+#ifdef DEBUG
+    Serial.println(F("Setup storage full"));
+#endif
+    return (false);
+  }
+
+  preset_buf[PH_VERSION] = PRESET_LAYOUT;
+  crc = preset_crc(n, length);
+  preset_buf[PH_CRC] = crc >> 8;
+  preset_buf[PH_CRC + 1] = crc & 0xff;
+
+  for (i = 0; i < blocks; i++)
+    EEPROM.update(preset_block_addr(list[i]), i + 1 < blocks ? list[i + 1] : PRESET_NONE);
+  for (j = 0; j < length; j++)
+    EEPROM.update(preset_data_addr(list, j), preset_buf[j]);
+  EEPROM.update(PRESET_DIR_ADDR + n - 1, list[0]);
+
+  for (i = 0; i < old_blocks; i++)
+    bitClear(preset_used[old_list[i] >> 3], old_list[i] & 7);
+  for (i = 0; i < blocks; i++)
+    bitSet(preset_used[list[i] >> 3], list[i] & 7);
+  return (true);
+}
+
+// Mark the blocks of all stored setups as used
+void preset_begin(void)
+{
+  uint8_t list[PRESET_MAX_BLOCKS];
+  uint8_t n, i, blocks;
+
+  preset_format = EEPROM.read(PRESET_FORMAT_ADDR);
+  memset(preset_used, 0, sizeof(preset_used));
+  for (n = 1; n <= PRESETS; n++)
+    if (preset_locate(n, list, blocks))
+      for (i = 0; i < blocks; i++)
+        bitSet(preset_used[list[i] >> 3], list[i] & 7);
+}
+
+// Drop all stored setups
+void preset_format_all(void)
+{
+  EEPROM.update(PRESET_FORMAT_ADDR, uint8_t(preset_format + 1));
+  preset_begin();
+}
+
+//
+// Live setup write-behind
+//
+
+// Find the newest live slot: the sequence numbers count up from slot 0 to
+// it. Load the newest intact one, or the defaults if there's none. The
+// newest slot is then rewritten in full by the next commit.
+void storage_begin(void)
+{
+  uint8_t i, k, seq;
+
+  live_slot = 0;
+  live_seq = EEPROM.read(LH_SEQ);
+  for (i = 1; i < LIVE_SLOTS; i++)
+  {
+    seq = EEPROM.read(i * LIVE_SLOT_SIZE + LH_SEQ);
+    if (seq != uint8_t(live_seq + 1))
+      break;
+    live_slot = i;
+    live_seq = seq;
+  }
+  for (k = 0; k < LIVE_SLOTS; k++)
+    if (live_read((live_slot + LIVE_SLOTS - k) % LIVE_SLOTS))
+      break;
+  if (k == LIVE_SLOTS)
+  {
+#ifdef DEBUG
+    Serial.println(F("No live setup, defaults"));
+#endif
+    setup_defaults(live_cache);
+  }
+  if (k > 0)
+    live_mark_all();
+  else
+  {
+    memset(live_dirty, 0, sizeof(live_dirty));
+    live_pending = 0;
+  }
+  live_commits = 0;
+  live_session = false;
+
+  preset_begin();
+}
+
+uint16_t live_crc_init(void)
+{
+  return (crc16_update(crc16_update(0xffff, SETUP_SIZE & 0xff), SETUP_SIZE >> 8));
+}
+
+// Read live slot <slot> to live_cache, false if it's from another version
+// or doesn't pass the CRC
+bool live_read(uint8_t slot)
+{
+  uint16_t a, crc = live_crc_init();
+
+  a = slot * LIVE_SLOT_SIZE;
+  if (EEPROM.read(a + LH_VERSION) != LIVE_VERSION)
+    return (false);
+  for (uint16_t i = 0; i < SETUP_SIZE; i++)
+  {
+    live_cache[i] = EEPROM.read(a + LIVE_HEADER + i);
+    crc = crc16_update(crc, live_cache[i]);
+  }
+  return (EEPROM.read(a + LH_CRC) == (crc & 0xff) && EEPROM.read(a + LH_CRC + 1) == (crc >> 8));
+}
+
+// Have all of live_cache written again
+void live_mark_all(void)
+{
+  memset(live_dirty, 0xff, sizeof(live_dirty));
+  live_dirty[sizeof(live_dirty) - 1] = 0xff >> (sizeof(live_dirty) * 8 - SETUP_SIZE);
+  live_pending = SETUP_SIZE;
+  live_crc_pos = 0;
+  live_head_pos = 0;
+}
+
+// Change the live setup in RAM, bytes that differ are marked for commit
+void storage_put(uint16_t offset, const void *data, uint16_t size)
+{
+  const uint8_t *d = (const uint8_t*)data;
+
+  for (; size; size--, offset++, d++)
+  {
+    if (live_cache[offset] == *d)
+      continue;
+    live_cache[offset] = *d;
+    live_crc_pos = 0; // checksum and header again
+    live_head_pos = 0;
+    if (!bitRead(live_dirty[offset >> 3], offset & 7))
+    {
+      bitSet(live_dirty[offset >> 3], offset & 7);
+      live_pending++;
+    }
+  }
+}
+
+// One commit step: write the next dirty byte if EEPROM doesn't have it
+// already, then checksum the setup a chunk at a time, then write the
+// header a byte at a time. Every LIVE_ROTATE commits the session goes to
+// the next slot, the whole setup is compared then and the sequence
+// number, written last, makes the new slot the live one.
+void storage_commit(void)
+{
+  uint16_t a;
+  uint8_t i, value;
+
+  if (EECR & _BV(EEPE))
+    return; // last write still going
+
+  if (!live_session)
+  {
+    live_session = true;
+    if (++live_commits >= LIVE_ROTATE)
+    {
+      live_commits = 0;
+      live_slot = (live_slot + 1) % LIVE_SLOTS;
+      live_seq++;
+      live_mark_all();
+    }
+    live_pos = 0;
+    live_crc_pos = 0;
+    live_head_pos = 0;
+  }
+
+  if (live_pending == 0)
+  {
+    if (live_crc_pos < SETUP_SIZE)
+    {
+      if (live_crc_pos == 0)
+        live_crc = live_crc_init();
+      for (i = 0; i < LIVE_CRC_CHUNK && live_crc_pos < SETUP_SIZE; i++)
+        live_crc = crc16_update(live_crc, live_cache[live_crc_pos++]);
+      return;
+    }
+    // Version, CRC, then the sequence number
+    while (live_head_pos < LIVE_HEADER)
+    {
+      i = (live_head_pos + 1) % LIVE_HEADER;
+      value = i == LH_SEQ ? live_seq : i == LH_VERSION ? LIVE_VERSION : i == LH_CRC ? live_crc & 0xff : live_crc >> 8;
+      live_head_pos++;
+      a = live_slot * LIVE_SLOT_SIZE + i;
+      if (EEPROM.read(a) != value)
+      {
+        EEPROM.write(a, value);
+        return;
+      }
+    }
+    live_session = false;
+    return;
+  }
+
+  while (!bitRead(live_dirty[live_pos >> 3], live_pos & 7))
+    live_pos = uint16_t(live_pos + 1) < SETUP_SIZE ? live_pos + 1 : 0;
+  bitClear(live_dirty[live_pos >> 3], live_pos & 7);
+  live_pending--;
+  a = live_slot * LIVE_SLOT_SIZE + LIVE_HEADER + live_pos;
+  if (EEPROM.read(a) != live_cache[live_pos])
+    EEPROM.write(a, live_cache[live_pos]);
+}
+
+// Commit everything now, for explicit saves (blocks 3.3ms per byte)
+void storage_flush(void)
+{
+  while (live_pending || live_session)
+    storage_commit();
+}
+
+bool restore_setup(uint16_t n)
+{
+  if (!load_setup(n))
+    return (false);
+  send_setup();
+  return (true);
+}
+
+// Send the loaded setup, only what differs from the applied one
+void send_setup(void)
+{
+  uint8_t v;
+
+  if (!applied_valid)
+  {
+    // Nothing known about the synth, send all of it. The effect restart
+    // goes last, output is held while the synth settles.
+    setConfig();
+    for (v = 0; v < 16; v++)
+      setSynth(v);
+    synth.restartEffects();
+    synth.enableEffects(effect_flags(synth_config)); // the restart enables all
+    applied_config = synth_config;
+    applied_valid = true;
+    return;
+  }
+
+  // Only the differences, most audible first
+  for (v = 0; v < 16; v++)
+    diffSynthSound(v);
+  diffGlobals();
+  for (v = 0; v < 16; v++)
+    diffSynthDetails(v);
+  diffEffects();
+}
+
+// Differential recall: compare synth_config/synth_voice_config with what
+// was applied, send the changed fields only and remember them as applied.
+// Of the parameters setSynth/setConfig send twice (CC and NRPN, GM and GS
+// sysex), only the cheaper one is used.
+void diffSynthSound(uint8_t channel)
+{
+  SynthVoice &t = synth_voice_config[channel];
+  SynthVoice &a = applied_voice[channel];
+
+  if (t.patch != a.patch || t.bank != a.bank)
+    synth.programChange(channel, t.patch & 0x7f, t.patch >> 7);
+  if (t.volume != a.volume)
+    synth.setChannelVolume(channel, t.volume);
+  a.patch = t.patch;
+  a.bank = t.bank;
+  a.volume = t.volume;
+}
+
+void diffSynthDetails(uint8_t channel)
+{
+  SynthVoice &t = synth_voice_config[channel];
+  SynthVoice &a = applied_voice[channel];
+
+  if (t.pan != a.pan)
+    synth.GM_Pan(channel, t.pan);
+  if (t.reverb_send != a.reverb_send)
+    synth.setReverbSend(channel, t.reverb_send);
+  if (t.chorus_send != a.chorus_send)
+    synth.setChorusSend(channel, t.chorus_send);
+  if (t.bend_range != a.bend_range)
+    synth.setBendRange(channel, t.bend_range);
+  a = t;
+}
+
+void diffGlobals(void)
+{
+  SynthGlobal &t = synth_config;
+  SynthGlobal &a = applied_config;
+
+  if (t.level != a.level)
+    synth.setMasterVolume(t.level);
+  if (t.pan != a.pan)
+    synth.GS_MasterPan(t.pan);
+  if (t.clipping != a.clipping)
+    synth.setClippingMode(t.clipping);
+  if (t.transpose != a.transpose)
+    synth.setMasterTranspose(t.transpose);
+  a.level = t.level;
+  a.pan = t.pan;
+  a.clipping = t.clipping;
+  a.transpose = t.transpose;
+}
+
+void diffEffects(void)
+{
+  SynthGlobal &t = synth_config;
+  SynthGlobal &a = applied_config;
+
+  if (effect_flags(t) != effect_flags(a))
+    synth.enableEffects(effect_flags(t));
+
+  // Reverb. A new program presets all reverb parameters, level included.
+  if (t.reverb_program >= 0)
+  {
+    if (t.reverb_program != a.reverb_program)
+    {
+      synth.setReverb(t.reverb_program, t.reverb_time, t.reverb_feedback, t.reverb_character);
+      synth.setReverbLevel(t.reverb_level);
+    }
+    else
+    {
+      synth.beginParameterBlock();
+      if (t.reverb_character != a.reverb_character)
+        synth.setReverbCharacter(t.reverb_character);
+      if (t.reverb_time != a.reverb_time)
+        synth.setReverbTime(t.reverb_time);
+      if (t.reverb_feedback != a.reverb_feedback && (t.reverb_program & 0x07) > 5)
+        synth.setReverbFeedback(t.reverb_feedback);
+      if (t.reverb_level != a.reverb_level)
+        synth.setReverbLevel(t.reverb_level);
+      synth.endParameterBlock();
+    }
+  }
+
+  // Chorus, same as above. Off is level 0, on again sends the level.
+  if (t.chorus_program < 0 && a.chorus_program >= 0)
+    synth.setChorusLevel(0);
+  if (t.chorus_program >= 0)
+  {
+    if (t.chorus_program != a.chorus_program)
+    {
+      synth.setChorus(t.chorus_program, t.chorus_delay, t.chorus_feedback, t.chorus_rate, t.chorus_depth);
+      synth.setChorusLevel(t.chorus_level);
+    }
+    else
+    {
+      synth.beginParameterBlock();
+      if (t.chorus_level != a.chorus_level)
+        synth.setChorusLevel(t.chorus_level);
+      if (t.chorus_feedback != a.chorus_feedback)
+        synth.setChorusFeedback(t.chorus_feedback);
+      if (t.chorus_delay != a.chorus_delay)
+        synth.setChorusDelay(t.chorus_delay);
+      if (t.chorus_rate != a.chorus_rate)
+        synth.setChorusRate(t.chorus_rate);
+      if (t.chorus_depth != a.chorus_depth)
+        synth.setChorusDepth(t.chorus_depth);
+      synth.endParameterBlock();
+    }
+  }
+  applied_config = synth_config;
+}
+
+// Morph from setup <from> to setup <to> in <ms> milliseconds. Continuous
+// fields are interpolated and sent by morph_step() within MORPH_LINK_SHARE
+// of the link, largest weighted error first. Programs, bank, transpose,
+// clipping, reverb character and bend range switch at the end, the MIDI-IN
+// routing of <to> at the start.
+void morph_start(uint16_t from, uint16_t to, uint16_t ms)
+{
+  if (from >= setup_count() || to >= setup_count())
+    return;
+
+  morph_active = false;
+  if (!restore_setup(from))
+    return;
+  morph_from_config = synth_config;
+  memcpy(morph_from_voice, synth_voice_config, sizeof(morph_from_voice));
+  if (!load_setup(to))
+    return;
+  morph_to_config = synth_config;
+  memcpy(morph_to_voice, synth_voice_config, sizeof(morph_to_voice));
+  synth_config = morph_from_config;
+  memcpy(synth_voice_config, morph_from_voice, sizeof(synth_voice_config));
+
+  morph_ms = ms ? ms : 1;
+  morph_start_ms = morph_last_ms = millis();
+  morph_credit = 0;
+  morph_active = true;
+}
+
+void morph_stop(void)
+{
+  morph_active = false;
+}
+
+// Read a morphed field, int8_t or uint8_t
+int16_t morph_field(const void *base, uint8_t param[3])
+{
+  uint8_t b = ((const uint8_t*)base)[param[0]];
+  return (param[1] & MORPH_SIGNED ? int16_t(int8_t(b)) : int16_t(b));
+}
+
+// Interpolate one field into <cur>, returns the weighted error against
+// what the synth has. Fields that are OFF (negative) at either end don't
+// morph, they are left to the final recall.
+uint16_t morph_update(void *cur, const void *from, const void *to, const void *applied, uint8_t param[3], uint32_t t)
+{
+  int16_t a = morph_field(from, param);
+  int16_t b = morph_field(to, param);
+  int16_t v;
+
+  if ((param[1] & MORPH_SIGNED) && (a < 0 || b < 0))
+    return (0);
+  v = a + int16_t((int32_t(b - a) * int32_t(t)) / morph_ms);
+  ((uint8_t*)cur)[param[0]] = uint8_t(v);
+  v -= morph_field(applied, param);
+  return (uint16_t(v < 0 ? -v : v) * (param[1] & ~MORPH_SIGNED));
+}
+
+// One morph pass from loop(): advance the interpolation, then send the
+// most audible differences as far as the byte budget allows
+void morph_step(void)
+{
+  uint32_t now = millis();
+  uint32_t t = now - morph_start_ms;
+  uint8_t param[3], best_param[3];
+  uint16_t err, best;
+  int8_t best_channel = -1;
+  uint8_t i, v, n;
+
+  morph_credit += (now - morph_last_ms) * (FLUXAMA_BAUD / 10) * MORPH_LINK_SHARE / 100;
+  if (morph_credit > MORPH_BURST * 1000UL)
+    morph_credit = MORPH_BURST * 1000UL;
+  morph_last_ms = now;
+  if (t > morph_ms)
+    t = morph_ms;
+
+  for (n = 0; n < MORPH_SENDS_PER_STEP; n++)
+  {
+    best = 0;
+    for (i = 0; i < MORPH_GLOBALS; i++)
+    {
+      memcpy_P(param, morph_global_param[i], 3);
+      err = morph_update(&synth_config, &morph_from_config, &morph_to_config, &applied_config, param, t);
+      if (err > best)
+      {
+        best = err;
+        best_channel = -1;
+        memcpy(best_param, param, 3);
+      }
+    }
+    for (v = 0; v < 16; v++)
+    {
+      for (i = 0; i < MORPH_VOICE_PARAMS; i++)
+      {
+        memcpy_P(param, morph_voice_param[i], 3);
+        err = morph_update(&synth_voice_config[v], &morph_from_voice[v], &morph_to_voice[v], &applied_voice[v], param, t);
+        if (err > best)
+        {
+          best = err;
+          best_channel = v;
+          memcpy(best_param, param, 3);
+        }
+      }
+    }
+
+    if (best == 0)
+    {
+      if (t == morph_ms)
+      {
+        // Interpolation done, switch the rest through the differential recall
+        synth_config = morph_to_config;
+        memcpy(synth_voice_config, morph_to_voice, sizeof(synth_voice_config));
+        for (v = 0; v < 16; v++)
+          diffSynthSound(v);
+        diffGlobals();
+        for (v = 0; v < 16; v++)
+          diffSynthDetails(v);
+        diffEffects();
+        morph_active = false;
+        voice = synth_voice_config[channel].patch;
+        bitSet(refresh, REFRESH);
+      }
+      return;
+    }
+    if (morph_credit < best_param[2] * 1000UL || synth.txFree() < best_param[2])
+      return;
+    morph_credit -= best_param[2] * 1000UL;
+    morph_send(best_channel, best_param[0]);
+  }
+}
+
+// Send one morphed field and mark it applied
+void morph_send(int8_t channel, uint8_t offset)
+{
+  if (channel < 0)
+  {
+    uint8_t value = ((uint8_t*)&synth_config)[offset];
+
+    ((uint8_t*)&applied_config)[offset] = value;
+    switch (offset)
+    {
+      case offsetof(SynthGlobal, level):
+        synth.setMasterVolume(value);
+        break;
+      case offsetof(SynthGlobal, pan):
+        synth.GS_MasterPan(value);
+        break;
+      case offsetof(SynthGlobal, reverb_level):
+        synth.setReverbLevel(value);
+        break;
+      case offsetof(SynthGlobal, reverb_time):
+        synth.setReverbTime(value);
+        break;
+      case offsetof(SynthGlobal, reverb_feedback):
+        if ((synth_config.reverb_program & 0x07) > 5)
+          synth.setReverbFeedback(value);
+        break;
+      case offsetof(SynthGlobal, chorus_level):
+        synth.setChorusLevel(value);
+        break;
+      case offsetof(SynthGlobal, chorus_delay):
+        synth.setChorusDelay(value);
+        break;
+      case offsetof(SynthGlobal, chorus_feedback):
+        synth.setChorusFeedback(value);
+        break;
+      case offsetof(SynthGlobal, chorus_rate):
+        synth.setChorusRate(value);
+        break;
+      case offsetof(SynthGlobal, chorus_depth):
+        synth.setChorusDepth(value);
+        break;
+    }
+  }
+  else
+  {
+    uint8_t value = ((uint8_t*)&synth_voice_config[channel])[offset];
+
+    ((uint8_t*)&applied_voice[channel])[offset] = value;
+    switch (offset)
+    {
+      case offsetof(SynthVoice, volume):
+        synth.setChannelVolume(channel, value);
+        break;
+      case offsetof(SynthVoice, pan):
+        synth.GM_Pan(channel, value);
+        break;
+      case offsetof(SynthVoice, reverb_send):
+        synth.setReverbSend(channel, value);
+        break;
+      case offsetof(SynthVoice, chorus_send):
+        synth.setChorusSend(channel, value);
+        break;
+    }
+  }
+}
+
+// Read a setup, only the MIDI-IN routing is applied. False if the setup
+// isn't there or can't be used, nothing changes then.
+bool load_setup(uint16_t n)
+{
+  if (n >= setup_count() || !setup_open(n))
+    return (false);
+
+  setup_from_image(n == 0 ? live_cache : preset_image);
+  return (true);
+}
+
+#ifdef SETUP_LIBRARY_SD
+//
+// Setup library on the SD card: as many setups as there are slots, stored
+// packed like the EEPROM ones. They follow the EEPROM setups, see
+// setup_open().
+//
+
+void library_begin(void)
+{
+  if (!SD.begin(SD_CS_PIN))
+    return;
+  // Not FILE_WRITE, that appends every write
+  library_media.file = SD.open(SD_LIBRARY_FILE, O_READ | O_WRITE | O_CREAT);
+  if (!library_media.file)
+    return;
+  // Only a new (empty) file is formatted, a library that doesn't read
+  // right is left alone and not used
+  if (library_media.file.size() == 0)
+    library_ok = library.format(&library_media, SD_LIBRARY_SLOTS);
+  else
+    library_ok = library.begin(&library_media);
+#ifdef DEBUG
+  Serial.print(F("Setup library: "));
+  if (library_ok)
+    Serial.println(library.slots());
+  else
+    Serial.println(F("not usable"));
+#endif
+}
+
+// Pack <image> to library slot <slot>, the record is tagged with the
+// packing version and field layout
+bool library_write(uint16_t slot, uint8_t *image)
+{
+  uint8_t length;
+
+  if (!library_ok)
+    return (false);
+  memset(preset_buf, 0, sizeof(preset_buf));
+  length = preset_pack(true, image);
+  return (library.createRecord(slot, LIB_SETUP, length, PRESET_LAYOUT) &&
+          library.write(&preset_buf[PRESET_HEADER], length) == length &&
+          library.writeEnd());
+}
+
+// Unpack library slot <slot> to <image>. False if it's empty, not a setup,
+// from another packing version or layout, or corrupt.
+bool library_read(uint16_t slot, uint8_t *image)
+{
+  uint8_t type;
+  uint16_t length;
+
+  if (!library_ok || !library.openRecord(slot, type, length))
+    return (false);
+  if (type != LIB_SETUP || library.version() != PRESET_LAYOUT || length > sizeof(preset_buf) - PRESET_HEADER)
+  {
+#ifdef DEBUG
+    Serial.print(F("Library slot not a setup of this version: "));
+    Serial.println(slot);
+#endif
+    return (false);
+  }
+  library.read(&preset_buf[PRESET_HEADER], length);
+  if (!library.readEnd())
+  {
+#ifdef DEBUG
+    Serial.print(F("Library slot corrupt: "));
+    Serial.println(slot);
+#endif
+    return (false);
+  }
+  preset_pack(false, image);
+  return (true);
+}
+#endif
+
+#ifdef INIT_STORAGE
+// Formatting is instant: stored setups become invalid with the new format
+// id, the live setup is overwritten by the caller
+void init_storage(void)
+{
+  preset_format_all();
 }
 #endif
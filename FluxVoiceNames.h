@@ -1,523 +1,187 @@
 //
 // Storing names of the voices in PROGMEM
 //
+// Generated by tools/voicenames.py from tools/voicenames.txt, change the
+// names there. 1826 bytes of flash (3037 as plain strings).
+//
 #ifndef FLUXVOICENAMES_H
 #define FLUXVOICENAMES_H 1
-const char _voice0[] PROGMEM = "GrandPiano";
-const char _voice1[] PROGMEM = "BrightPiano";
-const char _voice2[] PROGMEM = "ElecGrandPiano";
-const char _voice3[] PROGMEM = "HonkyTonkPiano";
-const char _voice4[] PROGMEM = "ElecPiano1";
-const char _voice5[] PROGMEM = "ElecPiano2";
-const char _voice6[] PROGMEM = "Harpsichord";
-const char _voice7[] PROGMEM = "Clavinet";
-const char _voice8[] PROGMEM = "Celesta";
-const char _voice9[] PROGMEM = "Glockenspiel";
-const char _voice10[] PROGMEM = "MusicBox";
-const char _voice11[] PROGMEM = "Vibraphone";
-const char _voice12[] PROGMEM = "Marimba";
-const char _voice13[] PROGMEM = "Xylophone";
-const char _voice14[] PROGMEM = "TubularBells";
-const char _voice15[] PROGMEM = "Dulcimer";
-const char _voice16[] PROGMEM = "DrawbarOrgan";
-const char _voice17[] PROGMEM = "PercussiveOrgan";
-const char _voice18[] PROGMEM = "RockOrgan";
-const char _voice19[] PROGMEM = "ChurchOrgan";
-const char _voice20[] PROGMEM = "ReedOrgan";
-const char _voice21[] PROGMEM = "Accordion";
-const char _voice22[] PROGMEM = "Harmonica";
-const char _voice23[] PROGMEM = "TangoAccordion";
-const char _voice24[] PROGMEM = "AcouGuitarNylon";
-const char _voice25[] PROGMEM = "AcouGuitarSteel";
-const char _voice26[] PROGMEM = "JazzGuitar";
-const char _voice27[] PROGMEM = "CleanGuitar";
-const char _voice28[] PROGMEM = "MutedGuitar";
-const char _voice29[] PROGMEM = "OverdriveGuitar";
-const char _voice30[] PROGMEM = "DistGuitar";
-const char _voice31[] PROGMEM = "GuitarHarmon";
-const char _voice32[] PROGMEM = "AcousticBass";
-const char _voice33[] PROGMEM = "FingerBass";
-const char _voice34[] PROGMEM = "PickedBass";
-const char _voice35[] PROGMEM = "FretlessBass";
-const char _voice36[] PROGMEM = "SlapBass1";
-const char _voice37[] PROGMEM = "SlapBass2";
-const char _voice38[] PROGMEM = "SynthBass1";
-const char _voice39[] PROGMEM = "SynthBass2";
-const char _voice40[] PROGMEM = "Violin";
-const char _voice41[] PROGMEM = "Viola";
-const char _voice42[] PROGMEM = "Cello";
-const char _voice43[] PROGMEM = "Contrabass";
-const char _voice44[] PROGMEM = "TremoloStrings";
-const char _voice45[] PROGMEM = "PizzicatoStrings";
-const char _voice46[] PROGMEM = "OrchestralHarp";
-const char _voice47[] PROGMEM = "Timpani";
-const char _voice48[] PROGMEM = "StringEnsemble1";
-const char _voice49[] PROGMEM = "StringEnsemble2";
-const char _voice50[] PROGMEM = "SynthStrings1";
-const char _voice51[] PROGMEM = "SynthStrings2";
-const char _voice52[] PROGMEM = "ChoirAahs";
-const char _voice53[] PROGMEM = "VoiceOohs";
-const char _voice54[] PROGMEM = "SynthVoice";
-const char _voice55[] PROGMEM = "OrchestraHit";
-const char _voice56[] PROGMEM = "Trumpet";
-const char _voice57[] PROGMEM = "Trombone";
-const char _voice58[] PROGMEM = "Tuba";
-const char _voice59[] PROGMEM = "MutedTrumpet";
-const char _voice60[] PROGMEM = "FrenchHorn";
-const char _voice61[] PROGMEM = "BrassSection";
-const char _voice62[] PROGMEM = "SynthBrass1";
-const char _voice63[] PROGMEM = "SynthBrass2";
-const char _voice64[] PROGMEM = "SopranoSax";
-const char _voice65[] PROGMEM = "AltoSax";
-const char _voice66[] PROGMEM = "TenorSax";
-const char _voice67[] PROGMEM = "BaritoneSax";
-const char _voice68[] PROGMEM = "Oboe";
-const char _voice69[] PROGMEM = "EnglishHorn";
-const char _voice70[] PROGMEM = "Bassoon";
-const char _voice71[] PROGMEM = "Clarinet";
-const char _voice72[] PROGMEM = "Piccolo";
-const char _voice73[] PROGMEM = "Flute";
-const char _voice74[] PROGMEM = "Recorder";
-const char _voice75[] PROGMEM = "PanFlute";
-const char _voice76[] PROGMEM = "BlownBottle";
-const char _voice77[] PROGMEM = "Shakuhachi";
-const char _voice78[] PROGMEM = "Whistle";
-const char _voice79[] PROGMEM = "Ocarina";
-const char _voice80[] PROGMEM = "Lead_Square";
-const char _voice81[] PROGMEM = "Lead_Sawtooth";
-const char _voice82[] PROGMEM = "Lead_Calliope";
-const char _voice83[] PROGMEM = "Lead_Chiff";
-const char _voice84[] PROGMEM = "Lead_Charang";
-const char _voice85[] PROGMEM = "Lead_Voice";
-const char _voice86[] PROGMEM = "Lead_Fifths";
-const char _voice87[] PROGMEM = "Lead_BassLead";
-const char _voice88[] PROGMEM = "Pad_NewAge";
-const char _voice89[] PROGMEM = "Pad_Warm";
-const char _voice90[] PROGMEM = "Pad_Polysynth";
-const char _voice91[] PROGMEM = "Pad_Choir";
-const char _voice92[] PROGMEM = "Pad_Bowed";
-const char _voice93[] PROGMEM = "Pad_Metallic";
-const char _voice94[] PROGMEM = "Pad_Halo";
-const char _voice95[] PROGMEM = "Pad_Sweep";
-const char _voice96[] PROGMEM = "FX_Rain";
-const char _voice97[] PROGMEM = "FX_Soundtrack";
-const char _voice98[] PROGMEM = "FX_Crystal";
-const char _voice99[] PROGMEM = "FX_Atmosphere";
-const char _voice100[] PROGMEM = "FX_Brightness";
-const char _voice101[] PROGMEM = "FX_Goblins";
-const char _voice102[] PROGMEM = "FX_Echoes";
-const char _voice103[] PROGMEM = "FX_SciFi";
-const char _voice104[] PROGMEM = "Sitar";
-const char _voice105[] PROGMEM = "Banjo";
-const char _voice106[] PROGMEM = "Shamisen";
-const char _voice107[] PROGMEM = "Koto";
-const char _voice108[] PROGMEM = "Kalimba";
-const char _voice109[] PROGMEM = "Bagpipe";
-const char _voice110[] PROGMEM = "Fiddle";
-const char _voice111[] PROGMEM = "Shanai";
-const char _voice112[] PROGMEM = "TinkleBell";
-const char _voice113[] PROGMEM = "Agogo";
-const char _voice114[] PROGMEM = "SteelDrums";
-const char _voice115[] PROGMEM = "Woodblock";
-const char _voice116[] PROGMEM = "TaikoDrum";
-const char _voice117[] PROGMEM = "MelodicTom";
-const char _voice118[] PROGMEM = "SynthDrum";
-const char _voice119[] PROGMEM = "ReverseCymbal";
-const char _voice120[] PROGMEM = "GuitarFretNoise";
-const char _voice121[] PROGMEM = "BreathNoise";
-const char _voice122[] PROGMEM = "Seashore";
-const char _voice123[] PROGMEM = "BirdTweet";
-const char _voice124[] PROGMEM = "TelephoneRing";
-const char _voice125[] PROGMEM = "Helicopter";
-const char _voice126[] PROGMEM = "Applause";
-const char _voice127[] PROGMEM = "Gunshot";
-const char _voice128[] PROGMEM = "AcouPiano1";
-const char _voice129[] PROGMEM = "AcouPiano2";
-const char _voice130[] PROGMEM = "AcouPiano3";
-const char _voice131[] PROGMEM = "ElecPiano1";
-const char _voice132[] PROGMEM = "ElecPiano2";
-const char _voice133[] PROGMEM = "ElecPiano3";
-const char _voice134[] PROGMEM = "ElecPiano4";
-const char _voice135[] PROGMEM = "Honky_Tonk";
-const char _voice136[] PROGMEM = "ElecOrg1";
-const char _voice137[] PROGMEM = "ElecOrg2";
-const char _voice138[] PROGMEM = "ElecOrg3";
-const char _voice139[] PROGMEM = "ElecOrg4";
-const char _voice140[] PROGMEM = "PipeOrg1";
-const char _voice141[] PROGMEM = "PipeOrg2";
-const char _voice142[] PROGMEM = "PipeOrg3";
-const char _voice143[] PROGMEM = "Accordion";
-const char _voice144[] PROGMEM = "Harpsi1";
-const char _voice145[] PROGMEM = "Harpsi2";
-const char _voice146[] PROGMEM = "Harpsi3";
-const char _voice147[] PROGMEM = "Clavi1";
-const char _voice148[] PROGMEM = "Clavi2";
-const char _voice149[] PROGMEM = "Clavi3";
-const char _voice150[] PROGMEM = "Celesta1";
-const char _voice151[] PROGMEM = "Celesta2";
-const char _voice152[] PROGMEM = "SynBrass1";
-const char _voice153[] PROGMEM = "SynBrass2";
-const char _voice154[] PROGMEM = "SynBrass3";
-const char _voice155[] PROGMEM = "SynBrass4";
-const char _voice156[] PROGMEM = "SynBass1";
-const char _voice157[] PROGMEM = "SynBass2";
-const char _voice158[] PROGMEM = "SynBass3";
-const char _voice159[] PROGMEM = "SynBass4";
-const char _voice160[] PROGMEM = "Fantasy";
-const char _voice161[] PROGMEM = "HarmoPan";
-const char _voice162[] PROGMEM = "Chorale";
-const char _voice163[] PROGMEM = "Glasses";
-const char _voice164[] PROGMEM = "Soundtrack";
-const char _voice165[] PROGMEM = "Atmosphere";
-const char _voice166[] PROGMEM = "WarmBell";
-const char _voice167[] PROGMEM = "FunnyVox";
-const char _voice168[] PROGMEM = "EchoBell";
-const char _voice169[] PROGMEM = "IceRain";
-const char _voice170[] PROGMEM = "Oboe2001";
-const char _voice171[] PROGMEM = "EchoPan";
-const char _voice172[] PROGMEM = "DrSolo";
-const char _voice173[] PROGMEM = "Schooldaze";
-const char _voice174[] PROGMEM = "Bellsinger";
-const char _voice175[] PROGMEM = "SquareWave";
-const char _voice176[] PROGMEM = "StrSect1";
-const char _voice177[] PROGMEM = "StrSect2";
-const char _voice178[] PROGMEM = "StrSect3";
-const char _voice179[] PROGMEM = "Pizzicato";
-const char _voice180[] PROGMEM = "Violin1";
-const char _voice181[] PROGMEM = "Violin2";
-const char _voice182[] PROGMEM = "Cello1";
-const char _voice183[] PROGMEM = "Cello2";
-const char _voice184[] PROGMEM = "Contrabass";
-const char _voice185[] PROGMEM = "Harp1";
-const char _voice186[] PROGMEM = "Harp2";
-const char _voice187[] PROGMEM = "Guitar1";
-const char _voice188[] PROGMEM = "Guitar2";
-const char _voice189[] PROGMEM = "ElecGtr1";
-const char _voice190[] PROGMEM = "ElecGtr2";
-const char _voice191[] PROGMEM = "Sitar";
-const char _voice192[] PROGMEM = "AcouBass1";
-const char _voice193[] PROGMEM = "AcouBass2";
-const char _voice194[] PROGMEM = "ElecBass1";
-const char _voice195[] PROGMEM = "ElecBass2";
-const char _voice196[] PROGMEM = "SlapBass1";
-const char _voice197[] PROGMEM = "SlapBass2";
-const char _voice198[] PROGMEM = "Fretless1";
-const char _voice199[] PROGMEM = "Fretless2";
-const char _voice200[] PROGMEM = "Flute1";
-const char _voice201[] PROGMEM = "Flute2";
-const char _voice202[] PROGMEM = "Piccolo1";
-const char _voice203[] PROGMEM = "Piccolo2";
-const char _voice204[] PROGMEM = "Recorder";
-const char _voice205[] PROGMEM = "PanPipes";
-const char _voice206[] PROGMEM = "Sax1";
-const char _voice207[] PROGMEM = "Sax2";
-const char _voice208[] PROGMEM = "Sax3";
-const char _voice209[] PROGMEM = "Sax4";
-const char _voice210[] PROGMEM = "Clarinet1";
-const char _voice211[] PROGMEM = "Clarinet2";
-const char _voice212[] PROGMEM = "Oboe";
-const char _voice213[] PROGMEM = "EnglHorn";
-const char _voice214[] PROGMEM = "Bassoon";
-const char _voice215[] PROGMEM = "Harmonica";
-const char _voice216[] PROGMEM = "Trumpet1";
-const char _voice217[] PROGMEM = "Trumpet2";
-const char _voice218[] PROGMEM = "Trombone1";
-const char _voice219[] PROGMEM = "Trombone2";
-const char _voice220[] PROGMEM = "FrHorn1";
-const char _voice221[] PROGMEM = "FrHorn2";
-const char _voice222[] PROGMEM = "Tuba";
-const char _voice223[] PROGMEM = "BrsSect1";
-const char _voice224[] PROGMEM = "BrsSect2";
-const char _voice225[] PROGMEM = "Vibe1";
-const char _voice226[] PROGMEM = "Vibe2";
-const char _voice227[] PROGMEM = "SynMallet";
-const char _voice228[] PROGMEM = "WindBell";
-const char _voice229[] PROGMEM = "Glock";
-const char _voice230[] PROGMEM = "TubeBell";
-const char _voice231[] PROGMEM = "Xylophone";
-const char _voice232[] PROGMEM = "Marimba";
-const char _voice233[] PROGMEM = "Koto";
-const char _voice234[] PROGMEM = "Sho";
-const char _voice235[] PROGMEM = "Shakuhachi";
-const char _voice236[] PROGMEM = "Whistle1";
-const char _voice237[] PROGMEM = "Whistle2";
-const char _voice238[] PROGMEM = "BottleBlow";
-const char _voice239[] PROGMEM = "BreathPipe";
-const char _voice240[] PROGMEM = "Timpani";
-const char _voice241[] PROGMEM = "MelodicTom";
-const char _voice242[] PROGMEM = "DeepSnare";
-const char _voice243[] PROGMEM = "ElecPerc1";
-const char _voice244[] PROGMEM = "ElecPerc2";
-const char _voice245[] PROGMEM = "Taiko";
-const char _voice246[] PROGMEM = "TaikoRim";
-const char _voice247[] PROGMEM = "Cymbal";
-const char _voice248[] PROGMEM = "Castanets";
-const char _voice249[] PROGMEM = "Triangle";
-const char _voice250[] PROGMEM = "OrcheHit";
-const char _voice251[] PROGMEM = "Telephone";
-const char _voice252[] PROGMEM = "BirdTweet";
-const char _voice253[] PROGMEM = "OneNoteJam";
-const char _voice254[] PROGMEM = "WaterBells";
-const char _voice255[] PROGMEM = "JungleTune";
 
-const char * const _voice_name[] PROGMEM =
-{
-  _voice0,
-  _voice1,
-  _voice2,
-  _voice3,
-  _voice4,
-  _voice5,
-  _voice6,
-  _voice7,
-  _voice8,
-  _voice9,
-  _voice10,
-  _voice11,
-  _voice12,
-  _voice13,
-  _voice14,
-  _voice15,
-  _voice16,
-  _voice17,
-  _voice18,
-  _voice19,
-  _voice20,
-  _voice21,
-  _voice22,
-  _voice23,
-  _voice24,
-  _voice25,
-  _voice26,
-  _voice27,
-  _voice28,
-  _voice29,
-  _voice30,
-  _voice31,
-  _voice32,
-  _voice33,
-  _voice34,
-  _voice35,
-  _voice36,
-  _voice37,
-  _voice38,
-  _voice39,
-  _voice40,
-  _voice41,
-  _voice42,
-  _voice43,
-  _voice44,
-  _voice45,
-  _voice46,
-  _voice47,
-  _voice48,
-  _voice49,
-  _voice50,
-  _voice51,
-  _voice52,
-  _voice53,
-  _voice54,
-  _voice55,
-  _voice56,
-  _voice57,
-  _voice58,
-  _voice59,
-  _voice60,
-  _voice61,
-  _voice62,
-  _voice63,
-  _voice64,
-  _voice65,
-  _voice66,
-  _voice67,
-  _voice68,
-  _voice69,
-  _voice70,
-  _voice71,
-  _voice72,
-  _voice73,
-  _voice74,
-  _voice75,
-  _voice76,
-  _voice77,
-  _voice78,
-  _voice79,
-  _voice80,
-  _voice81,
-  _voice82,
-  _voice83,
-  _voice84,
-  _voice85,
-  _voice86,
-  _voice87,
-  _voice88,
-  _voice89,
-  _voice90,
-  _voice91,
-  _voice92,
-  _voice93,
-  _voice94,
-  _voice95,
-  _voice96,
-  _voice97,
-  _voice98,
-  _voice99,
-  _voice100,
-  _voice101,
-  _voice102,
-  _voice103,
-  _voice104,
-  _voice105,
-  _voice106,
-  _voice107,
-  _voice108,
-  _voice109,
-  _voice110,
-  _voice111,
-  _voice112,
-  _voice113,
-  _voice114,
-  _voice115,
-  _voice116,
-  _voice117,
-  _voice118,
-  _voice119,
-  _voice120,
-  _voice121,
-  _voice122,
-  _voice123,
-  _voice124,
-  _voice125,
-  _voice126,
-  _voice127,
-  _voice128,
-  _voice129,
-  _voice130,
-  _voice131,
-  _voice132,
-  _voice133,
-  _voice134,
-  _voice135,
-  _voice136,
-  _voice137,
-  _voice138,
-  _voice139,
-  _voice140,
-  _voice141,
-  _voice142,
-  _voice143,
-  _voice144,
-  _voice145,
-  _voice146,
-  _voice147,
-  _voice148,
-  _voice149,
-  _voice150,
-  _voice151,
-  _voice152,
-  _voice153,
-  _voice154,
-  _voice155,
-  _voice156,
-  _voice157,
-  _voice158,
-  _voice159,
-  _voice160,
-  _voice161,
-  _voice162,
-  _voice163,
-  _voice164,
-  _voice165,
-  _voice166,
-  _voice167,
-  _voice168,
-  _voice169,
-  _voice170,
-  _voice171,
-  _voice172,
-  _voice173,
-  _voice174,
-  _voice175,
-  _voice176,
-  _voice177,
-  _voice178,
-  _voice179,
-  _voice180,
-  _voice181,
-  _voice182,
-  _voice183,
-  _voice184,
-  _voice185,
-  _voice186,
-  _voice187,
-  _voice188,
-  _voice189,
-  _voice190,
-  _voice191,
-  _voice192,
-  _voice193,
-  _voice194,
-  _voice195,
-  _voice196,
-  _voice197,
-  _voice198,
-  _voice199,
-  _voice200,
-  _voice201,
-  _voice202,
-  _voice203,
-  _voice204,
-  _voice205,
-  _voice206,
-  _voice207,
-  _voice208,
-  _voice209,
-  _voice210,
-  _voice211,
-  _voice212,
-  _voice213,
-  _voice214,
-  _voice215,
-  _voice216,
-  _voice217,
-  _voice218,
-  _voice219,
-  _voice220,
-  _voice221,
-  _voice222,
-  _voice223,
-  _voice224,
-  _voice225,
-  _voice226,
-  _voice227,
-  _voice228,
-  _voice229,
-  _voice230,
-  _voice231,
-  _voice232,
-  _voice233,
-  _voice234,
-  _voice235,
-  _voice236,
-  _voice237,
-  _voice238,
-  _voice239,
-  _voice240,
-  _voice241,
-  _voice242,
-  _voice243,
-  _voice244,
-  _voice245,
-  _voice246,
-  _voice247,
-  _voice248,
-  _voice249,
-  _voice250,
-  _voice251,
-  _voice252,
-  _voice253,
-  _voice254,
-  _voice255
+#define VOICE_NAMES 256
+#define VOICE_GROUP 16 // names per _voice_group entry
+#define VOICE_WORD 0x80 // first dictionary code
+
+// Dictionary: word n is _voice_words[_voice_word_start[n]] up to the
+// start of word n + 1
+const char _voice_words[] PROGMEM =
+  "AccordionAcouAtmosphereBassBassoonBellBellsBottle"
+  "BrassBreathCelestaCelloChoirClarinetClaviContrabass"
+  "CymbalElecEnsembleFluteFretlessGrandGuitarHarmonica"
+  "HarpHarpsiHonkyHornLeadMarimbaMelodicMuted"
+  "NoiseOboeOrgOrganPadPanPianoPiccolo"
+  "PipePizzicatoRecorderSaxSectShakuhachiSitarSlap"
+  "SoundtrackSquareSteelStrStringStringsSynSynth"
+  "TaikoTelephoneTimpaniTromboneTrumpetTweetViolinVoice"
+  "WhistleXylophone"
+  ;
+
+const uint16_t _voice_word_start[] PROGMEM = {
+  0, 9, 13, 23, 27, 34, 38, 43, 49, 54, 60, 67,
+  72, 77, 85, 90, 100, 106, 110, 118, 123, 131, 136, 142,
+  151, 155, 161, 166, 170, 174, 181, 188, 193, 198, 202, 205,
+  210, 213, 216, 221, 228, 232, 241, 249, 252, 256, 266, 271,
+  275, 285, 291, 296, 299, 305, 312, 315, 320, 325, 334, 341,
+  349, 356, 361, 367, 372, 379, 388
+};
+
+// Names: codes in _voice_text from _voice_group[n / VOICE_GROUP] on,
+// code counts in nibbles, low nibble first
+const uint16_t _voice_group[] PROGMEM = {
+  0, 92, 181, 248, 313, 372, 484, 593, 693, 742, 782, 877,
+  915, 956, 997, 1055
+};
+
+const uint8_t _voice_length[] PROGMEM = {
+  114, 99, 51, 139, 193, 168, 17, 136, 184, 117, 21, 97, 55, 101, 162, 117,
+  121, 39, 51, 51, 81, 17, 40, 27, 51, 51, 85, 194, 17, 36, 135, 51,
+  88, 150, 129, 17, 17, 33, 22, 113, 163, 122, 57, 72, 104, 59, 167, 118,
+  71, 74, 173, 137, 81, 72, 119, 102, 87, 150, 69, 133, 38, 88, 165, 120,
+  51, 51, 51, 99, 51, 51, 51, 19, 34, 34, 34, 34, 51, 51, 51, 51,
+  103, 119, 17, 133, 117, 85, 166, 90, 51, 19, 34, 34, 33, 34, 82, 21,
+  51, 51, 51, 34, 34, 34, 97, 34, 34, 34, 81, 17, 34, 34, 68, 84,
+  85, 117, 85, 21, 65, 19, 34, 37, 65, 105, 22, 20, 137, 24, 165, 166
+};
+
+const uint8_t _voice_text[] PROGMEM = {
+  149, 166, 66, 114, 105, 103, 104, 116, 166, 145, 149, 166, 154, 84, 111, 110,
+  107, 166, 145, 166, 49, 145, 166, 50, 72, 97, 114, 112, 115, 105, 99, 104,
+  111, 114, 100, 67, 108, 97, 118, 105, 110, 101, 116, 138, 71, 108, 111, 99,
+  107, 101, 110, 115, 112, 105, 101, 108, 77, 117, 115, 105, 99, 66, 111, 120,
+  86, 105, 98, 114, 97, 112, 104, 111, 110, 101, 157, 193, 84, 117, 98, 117,
+  108, 97, 114, 134, 68, 117, 108, 99, 105, 109, 101, 114, 68, 114, 97, 119,
+  98, 97, 114, 163, 80, 101, 114, 99, 117, 115, 115, 105, 118, 101, 163, 82,
+  111, 99, 107, 163, 67, 104, 117, 114, 99, 104, 163, 82, 101, 101, 100, 163,
+  128, 151, 84, 97, 110, 103, 111, 128, 129, 150, 78, 121, 108, 111, 110, 129,
+  150, 178, 74, 97, 122, 122, 150, 67, 108, 101, 97, 110, 150, 159, 150, 79,
+  118, 101, 114, 100, 114, 105, 118, 101, 150, 68, 105, 115, 116, 150, 150, 72,
+  97, 114, 109, 111, 110, 65, 99, 111, 117, 115, 116, 105, 99, 131, 70, 105,
+  110, 103, 101, 114, 131, 80, 105, 99, 107, 101, 100, 131, 148, 131, 175, 131,
+  49, 175, 131, 50, 183, 131, 49, 183, 131, 50, 190, 86, 105, 111, 108, 97,
+  139, 143, 84, 114, 101, 109, 111, 108, 111, 181, 169, 181, 79, 114, 99, 104,
+  101, 115, 116, 114, 97, 108, 152, 186, 180, 146, 49, 180, 146, 50, 183, 181,
+  49, 183, 181, 50, 140, 65, 97, 104, 115, 191, 79, 111, 104, 115, 183, 191,
+  79, 114, 99, 104, 101, 115, 116, 114, 97, 72, 105, 116, 188, 187, 84, 117,
+  98, 97, 159, 188, 70, 114, 101, 110, 99, 104, 155, 136, 83, 101, 99, 116,
+  105, 111, 110, 183, 136, 49, 183, 136, 50, 83, 111, 112, 114, 97, 110, 111,
+  171, 65, 108, 116, 111, 171, 84, 101, 110, 111, 114, 171, 66, 97, 114, 105,
+  116, 111, 110, 101, 171, 161, 69, 110, 103, 108, 105, 115, 104, 155, 132, 141,
+  167, 147, 170, 165, 147, 66, 108, 111, 119, 110, 135, 173, 192, 79, 99, 97,
+  114, 105, 110, 97, 156, 95, 177, 156, 95, 83, 97, 119, 116, 111, 111, 116,
+  104, 156, 95, 67, 97, 108, 108, 105, 111, 112, 101, 156, 95, 67, 104, 105,
+  102, 102, 156, 95, 67, 104, 97, 114, 97, 110, 103, 156, 95, 191, 156, 95,
+  70, 105, 102, 116, 104, 115, 156, 95, 131, 156, 164, 95, 78, 101, 119, 65,
+  103, 101, 164, 95, 87, 97, 114, 109, 164, 95, 80, 111, 108, 121, 115, 121,
+  110, 116, 104, 164, 95, 140, 164, 95, 66, 111, 119, 101, 100, 164, 95, 77,
+  101, 116, 97, 108, 108, 105, 99, 164, 95, 72, 97, 108, 111, 164, 95, 83,
+  119, 101, 101, 112, 70, 88, 95, 82, 97, 105, 110, 70, 88, 95, 176, 70,
+  88, 95, 67, 114, 121, 115, 116, 97, 108, 70, 88, 95, 130, 70, 88, 95,
+  66, 114, 105, 103, 104, 116, 110, 101, 115, 115, 70, 88, 95, 71, 111, 98,
+  108, 105, 110, 115, 70, 88, 95, 69, 99, 104, 111, 101, 115, 70, 88, 95,
+  83, 99, 105, 70, 105, 174, 66, 97, 110, 106, 111, 83, 104, 97, 109, 105,
+  115, 101, 110, 75, 111, 116, 111, 75, 97, 108, 105, 109, 98, 97, 66, 97,
+  103, 112, 105, 112, 101, 70, 105, 100, 100, 108, 101, 83, 104, 97, 110, 97,
+  105, 84, 105, 110, 107, 108, 101, 133, 65, 103, 111, 103, 111, 178, 68, 114,
+  117, 109, 115, 87, 111, 111, 100, 98, 108, 111, 99, 107, 184, 68, 114, 117,
+  109, 158, 84, 111, 109, 183, 68, 114, 117, 109, 82, 101, 118, 101, 114, 115,
+  101, 144, 150, 70, 114, 101, 116, 160, 137, 160, 83, 101, 97, 115, 104, 111,
+  114, 101, 66, 105, 114, 100, 189, 185, 82, 105, 110, 103, 72, 101, 108, 105,
+  99, 111, 112, 116, 101, 114, 65, 112, 112, 108, 97, 117, 115, 101, 71, 117,
+  110, 115, 104, 111, 116, 129, 166, 49, 129, 166, 50, 129, 166, 51, 145, 166,
+  49, 145, 166, 50, 145, 166, 51, 145, 166, 52, 154, 95, 84, 111, 110, 107,
+  145, 162, 49, 145, 162, 50, 145, 162, 51, 145, 162, 52, 168, 162, 49, 168,
+  162, 50, 168, 162, 51, 128, 153, 49, 153, 50, 153, 51, 142, 49, 142, 50,
+  142, 51, 138, 49, 138, 50, 182, 136, 49, 182, 136, 50, 182, 136, 51, 182,
+  136, 52, 182, 131, 49, 182, 131, 50, 182, 131, 51, 182, 131, 52, 70, 97,
+  110, 116, 97, 115, 121, 72, 97, 114, 109, 111, 165, 67, 104, 111, 114, 97,
+  108, 101, 71, 108, 97, 115, 115, 101, 115, 176, 130, 87, 97, 114, 109, 133,
+  70, 117, 110, 110, 121, 86, 111, 120, 69, 99, 104, 111, 133, 73, 99, 101,
+  82, 97, 105, 110, 161, 50, 48, 48, 49, 69, 99, 104, 111, 165, 68, 114,
+  83, 111, 108, 111, 83, 99, 104, 111, 111, 108, 100, 97, 122, 101, 66, 101,
+  108, 108, 115, 105, 110, 103, 101, 114, 177, 87, 97, 118, 101, 179, 172, 49,
+  179, 172, 50, 179, 172, 51, 169, 190, 49, 190, 50, 139, 49, 139, 50, 143,
+  152, 49, 152, 50, 150, 49, 150, 50, 145, 71, 116, 114, 49, 145, 71, 116,
+  114, 50, 174, 129, 131, 49, 129, 131, 50, 145, 131, 49, 145, 131, 50, 175,
+  131, 49, 175, 131, 50, 148, 49, 148, 50, 147, 49, 147, 50, 167, 49, 167,
+  50, 170, 165, 80, 105, 112, 101, 115, 171, 49, 171, 50, 171, 51, 171, 52,
+  141, 49, 141, 50, 161, 69, 110, 103, 108, 155, 132, 151, 188, 49, 188, 50,
+  187, 49, 187, 50, 70, 114, 155, 49, 70, 114, 155, 50, 84, 117, 98, 97,
+  66, 114, 115, 172, 49, 66, 114, 115, 172, 50, 86, 105, 98, 101, 49, 86,
+  105, 98, 101, 50, 182, 77, 97, 108, 108, 101, 116, 87, 105, 110, 100, 133,
+  71, 108, 111, 99, 107, 84, 117, 98, 101, 133, 193, 157, 75, 111, 116, 111,
+  83, 104, 111, 173, 192, 49, 192, 50, 135, 66, 108, 111, 119, 137, 168, 186,
+  158, 84, 111, 109, 68, 101, 101, 112, 83, 110, 97, 114, 101, 145, 80, 101,
+  114, 99, 49, 145, 80, 101, 114, 99, 50, 184, 184, 82, 105, 109, 144, 67,
+  97, 115, 116, 97, 110, 101, 116, 115, 84, 114, 105, 97, 110, 103, 108, 101,
+  79, 114, 99, 104, 101, 72, 105, 116, 185, 66, 105, 114, 100, 189, 79, 110,
+  101, 78, 111, 116, 101, 74, 97, 109, 87, 97, 116, 101, 114, 134, 74, 117,
+  110, 103, 108, 101, 84, 117, 110, 101
+};
+
+// Browsing index, 470 bytes. Families as in PgmChange.h, drum kits
+// are browsed by _drum_prog_map:
+// 0 Piano sounds, 1 Chromatic Percussion, 2 Organs, 3 Guitars
+// 4 Basses, 5 Strings, 6 Ensembles, 7 Brass
+// 8 Reeds, 9 Pipes, 10 Synth Leads, 11 Synth Pads
+// 12 Synth Effects, 13 Ethnic instruments, 14 Percussive instruments, 15 Sound Effects
+#define VOICE_FAMILIES 16
+#define VOICE_NO_PROGRAM 0xFF // family not in the bank
+
+// Family of each name, in nibbles like _voice_length
+const uint8_t _voice_family[] PROGMEM = {
+  0, 0, 0, 0, 17, 17, 17, 17, 34, 34, 34, 34, 51, 51, 51, 51,
+  68, 68, 68, 68, 85, 85, 85, 85, 102, 102, 102, 102, 119, 119, 119, 119,
+  136, 136, 136, 136, 153, 153, 153, 153, 170, 170, 170, 170, 187, 187, 187, 187,
+  204, 204, 204, 204, 221, 221, 221, 221, 238, 238, 238, 238, 255, 255, 255, 255,
+  0, 0, 0, 0, 34, 34, 34, 34, 0, 0, 0, 17, 119, 119, 68, 68,
+  204, 204, 204, 204, 204, 204, 204, 172, 102, 86, 85, 85, 85, 53, 51, 211,
+  68, 68, 68, 68, 153, 153, 153, 136, 136, 136, 136, 40, 119, 119, 119, 119,
+  23, 17, 17, 17, 209, 157, 153, 153, 238, 238, 238, 238, 238, 246, 255, 255
+};
+
+// First program of each family, per bank
+const uint8_t _voice_family_first[][VOICE_FAMILIES] PROGMEM = {
+  { 0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120 },
+  { 0, 22, 8, 59, 28, 51, 48, 24, 78, 72, 47, 255, 32, 63, 112, 123 }
+};
+
+// Programs of each bank in alphabetical order, _voice_letter has where
+// A-Z start in it (and the end)
+const uint8_t _voice_alpha[][128] PROGMEM = {
+  {
+    21, 24, 25, 32, 113, 65, 126, 109, 105, 67, 70, 123, 76, 61, 121, 1,
+    8, 42, 52, 19, 71, 7, 27, 43, 30, 16, 15, 2, 4, 5, 69, 110,
+    33, 73, 60, 35, 99, 100, 98, 102, 101, 96, 103, 97, 9, 0, 120, 31,
+    127, 22, 6, 125, 3, 26, 108, 107, 87, 82, 84, 83, 86, 81, 80, 85,
+    12, 117, 10, 28, 59, 68, 79, 55, 46, 29, 92, 91, 94, 93, 88, 90,
+    95, 89, 75, 17, 72, 34, 45, 74, 20, 119, 18, 122, 77, 106, 111, 104,
+    36, 37, 64, 114, 48, 49, 38, 39, 62, 63, 118, 50, 51, 54, 116, 23,
+    124, 66, 47, 112, 44, 57, 56, 58, 14, 11, 41, 40, 53, 78, 115, 13
+  },
+  {
+    15, 64, 65, 0, 1, 2, 37, 86, 46, 124, 110, 111, 95, 96, 120, 22,
+    23, 54, 55, 34, 82, 83, 19, 20, 21, 56, 119, 114, 44, 40, 43, 66,
+    67, 61, 62, 8, 9, 10, 11, 115, 116, 3, 4, 5, 6, 85, 32, 72,
+    73, 70, 71, 92, 93, 39, 35, 101, 59, 60, 87, 33, 57, 58, 16, 17,
+    18, 7, 41, 127, 105, 104, 113, 84, 42, 125, 122, 77, 74, 75, 12, 13,
+    14, 51, 76, 78, 79, 80, 81, 45, 107, 106, 63, 68, 69, 36, 47, 48,
+    49, 50, 28, 29, 30, 31, 24, 25, 26, 27, 99, 117, 118, 123, 112, 121,
+    90, 91, 88, 89, 94, 102, 97, 98, 52, 53, 38, 126, 108, 109, 100, 103
+  }
+};
+
+const uint8_t _voice_letter[][27] PROGMEM = {
+  { 0, 7, 16, 24, 27, 31, 44, 49, 53, 53, 54, 56, 64, 69, 69, 74, 87, 87, 91, 110, 121, 121, 125, 127, 128, 128, 128 },
+  { 0, 7, 14, 27, 29, 46, 54, 58, 66, 67, 68, 69, 69, 71, 71, 75, 82, 82, 83, 107, 118, 118, 122, 127, 128, 128, 128 }
 };
 
 const char _drum0[] PROGMEM = "Standard";
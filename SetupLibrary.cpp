@@ -0,0 +1,178 @@
+//
+// Setup library on external storage, see SetupLibrary.h
+//
+#include <string.h>
+#include "SetupLibrary.h"
+
+uint16_t crc16_update(uint16_t crc, uint8_t b)
+{
+  uint8_t i;
+
+  crc ^= uint16_t(b) << 8;
+  for (i = 0; i < 8; i++)
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1; // CCITT
+  return (crc);
+}
+
+SetupLibrary::SetupLibrary()
+{
+  _media = 0;
+  _slots = 0;
+  _slot = 0;
+  _type = LIB_EMPTY;
+  _version = 0;
+  _length = 0;
+  _pos = 0;
+  _crc = 0;
+  _crcRecord = 0;
+}
+
+bool SetupLibrary::begin(LibraryMedia *media)
+{
+  uint8_t h[LIB_HEADER];
+
+  _media = media;
+  _slots = 0;
+  if (!_media->read(0, h, LIB_HEADER))
+    return (false);
+  if (memcmp(h, "FCSL", 4) != 0 || h[4] != LIB_VERSION || (h[6] | (h[7] << 8)) != LIB_SLOT_SIZE)
+    return (false);
+  _slots = h[8] | (h[9] << 8);
+  return (_slots > 0);
+}
+
+// Writes the header only, slots that were never written read as empty
+bool SetupLibrary::format(LibraryMedia *media, uint16_t slots)
+{
+  uint8_t h[LIB_HEADER] = { 'F', 'C', 'S', 'L', LIB_VERSION, 0,
+                                LIB_SLOT_SIZE & 0xff, LIB_SLOT_SIZE >> 8,
+                                uint8_t(slots & 0xff), uint8_t(slots >> 8) };
+  uint16_t n;
+
+  _media = media;
+  if (!_media->write(0, h, sizeof(h)))
+    return (false);
+  _slots = slots;
+  for (n = 0; n < slots; n++)
+    if (type(n) != LIB_EMPTY && !erase(n))
+      return (false);
+  _media->sync();
+  return (true);
+}
+
+bool SetupLibrary::_readHeader(uint16_t n, uint8_t &type, uint16_t &length, uint16_t &crc, uint8_t &version)
+{
+  uint8_t h[LIB_RECORD_HEADER];
+
+  type = LIB_EMPTY;
+  if (!_media || n >= _slots || !_media->read(_slotPos(n), h, LIB_RECORD_HEADER))
+    return (false);
+  version = h[1];
+  length = h[2] | (h[3] << 8);
+  crc = h[4] | (h[5] << 8);
+  if (h[0] == 0xFF || h[0] == LIB_EMPTY || length > LIB_MAX_RECORD)
+    return (false);
+  type = h[0];
+  return (true);
+}
+
+uint8_t SetupLibrary::type(uint16_t n)
+{
+  uint8_t t, version;
+  uint16_t length, crc;
+
+  _readHeader(n, t, length, crc, version);
+  return (t);
+}
+
+bool SetupLibrary::openRecord(uint16_t n, uint8_t &type, uint16_t &length)
+{
+  if (!_readHeader(n, type, length, _crcRecord, _version))
+    return (false);
+  _slot = n;
+  _type = type;
+  _length = length;
+  _pos = 0;
+  _crc = 0xffff;
+  return (true);
+}
+
+uint16_t SetupLibrary::read(uint8_t *buf, uint16_t len)
+{
+  uint16_t i;
+
+  if (len > _length - _pos)
+    len = _length - _pos;
+  if (len == 0 || !_media->read(_slotPos(_slot) + LIB_RECORD_HEADER + _pos, buf, len))
+    return (0);
+  for (i = 0; i < len; i++)
+    _crc = crc16_update(_crc, buf[i]);
+  _pos += len;
+  return (len);
+}
+
+bool SetupLibrary::readEnd()
+{
+  return (_pos == _length && _crc == _crcRecord);
+}
+
+bool SetupLibrary::verifyRecord(uint16_t n)
+{
+  uint8_t t, buf[32];
+  uint16_t length;
+
+  if (!openRecord(n, t, length))
+    return (false);
+  while (read(buf, sizeof(buf)))
+    ;
+  return (readEnd());
+}
+
+bool SetupLibrary::createRecord(uint16_t n, uint8_t type, uint16_t length, uint8_t version)
+{
+  if (!_media || n >= _slots || length > LIB_MAX_RECORD || type == LIB_EMPTY || type == 0xFF)
+    return (false);
+  _slot = n;
+  _type = type;
+  _version = version;
+  _length = length;
+  _pos = 0;
+  _crc = 0xffff;
+  return (true);
+}
+
+uint16_t SetupLibrary::write(const uint8_t *buf, uint16_t len)
+{
+  uint16_t i;
+
+  if (len > _length - _pos)
+    len = _length - _pos;
+  if (len == 0 || !_media->write(_slotPos(_slot) + LIB_RECORD_HEADER + _pos, buf, len))
+    return (0);
+  for (i = 0; i < len; i++)
+    _crc = crc16_update(_crc, buf[i]);
+  _pos += len;
+  return (len);
+}
+
+// The record header goes last, a record cut short keeps the old CRC and
+// reads as corrupt instead of passing as new
+bool SetupLibrary::writeEnd()
+{
+  uint8_t h[LIB_RECORD_HEADER] = { _type, _version, uint8_t(_length & 0xff), uint8_t(_length >> 8),
+                                   uint8_t(_crc & 0xff), uint8_t(_crc >> 8) };
+
+  if (_pos != _length || !_media->write(_slotPos(_slot), h, LIB_RECORD_HEADER))
+    return (false);
+  _media->sync();
+  return (true);
+}
+
+bool SetupLibrary::erase(uint16_t n)
+{
+  uint8_t h[LIB_RECORD_HEADER] = { LIB_EMPTY, 0, 0, 0, 0, 0 };
+
+  if (!_media || n >= _slots)
+    return (false);
+  return (_media->write(_slotPos(n), h, LIB_RECORD_HEADER));
+}
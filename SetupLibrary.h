@@ -0,0 +1,83 @@
+//
+// Setup library on external storage (SD card, host file)
+//
+// The library is one file of fixed size slots, slot n starts at
+// (n + 1) * slot size, so a setup is found by its number without any
+// search. The first slot holds the library header. Each slot holds one
+// record: a header (type, length, CRC) followed by the data. Records are
+// streamed in pieces, only the piece being read or written needs RAM.
+//
+// Library header: "FCSL", version, 0, slot size, slots (little endian)
+// Record header: type, version, length, CRC-16 over the data (little
+// endian). The version is the writer's, for telling data layouts apart.
+//
+#ifndef SETUPLIBRARY_H
+#define SETUPLIBRARY_H 1
+
+#include <stdint.h>
+
+#define LIB_VERSION 1
+#define LIB_SLOT_SIZE 512 // SD sector
+#define LIB_HEADER 10
+#define LIB_RECORD_HEADER 6
+#define LIB_MAX_RECORD (LIB_SLOT_SIZE - LIB_RECORD_HEADER)
+
+// Record types
+#define LIB_EMPTY 0x00 // as is 0xFF (erased)
+#define LIB_SETUP 0x01 // packed setup, see preset_pack() in the sketch
+
+uint16_t crc16_update(uint16_t crc, uint8_t b); // CCITT
+
+// Storage below a library, byte addressed. write() past the end has to
+// extend the media.
+class LibraryMedia
+{
+  public:
+    virtual bool read(uint32_t pos, uint8_t *buf, uint16_t len) = 0;
+    virtual bool write(uint32_t pos, const uint8_t *buf, uint16_t len) = 0;
+    virtual void sync() {}
+};
+
+class SetupLibrary
+{
+  public:
+    SetupLibrary();
+    bool begin(LibraryMedia *media); // false if there's no library on it
+    bool format(LibraryMedia *media, uint16_t slots);
+    uint16_t slots() { return _slots; }
+
+    // Record type of slot n, LIB_EMPTY if there's none
+    uint8_t type(uint16_t n);
+
+    // Reading: openRecord, read in pieces, then readEnd tells if the CRC
+    // was right. verifyRecord checks the CRC first, without any buffer.
+    bool openRecord(uint16_t n, uint8_t &type, uint16_t &length);
+    uint8_t version() { return _version; } // of the open record
+    uint16_t read(uint8_t *buf, uint16_t len);
+    bool readEnd();
+    bool verifyRecord(uint16_t n);
+
+    // Writing: createRecord, write exactly <length> bytes in pieces, then
+    // writeEnd stores the record header. A record cut short reads corrupt.
+    bool createRecord(uint16_t n, uint8_t type, uint16_t length, uint8_t version = 0);
+    uint16_t write(const uint8_t *buf, uint16_t len);
+    bool writeEnd();
+
+    bool erase(uint16_t n);
+
+  protected:
+    LibraryMedia *_media;
+    uint16_t _slots;
+    uint16_t _slot;   // record being read or written
+    uint8_t  _type;
+    uint8_t  _version;
+    uint16_t _length;
+    uint16_t _pos;    // bytes read or written so far
+    uint16_t _crc;    // running CRC
+    uint16_t _crcRecord; // CRC from the record header
+
+    uint32_t _slotPos(uint16_t n) { return uint32_t(n + 1) * LIB_SLOT_SIZE; }
+    bool _readHeader(uint16_t n, uint8_t &type, uint16_t &length, uint16_t &crc, uint8_t &version);
+};
+
+#endif
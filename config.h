@@ -1,8 +1,17 @@
-#ifdef CONFIG_H
+#ifndef CONFIG_H
 #define CONFIG_H 1
 
-#define DEBUG 1
+//#define DEBUG 1
 //#define INIT_STORAGE 1
-#define PLAY_TEST_CHORD 1
+//#define PLAY_TEST_CHORD 1
+
+// Fluxama link: use hardware USART2 (TX2, pin 16) or USART3 (TX3, pin 14)
+// instead of SoftwareSerial on FLUXAMA_MIDI_OUT_PIN. The shield's MIDI
+// input has to be jumpered to that pin. Output is then interrupt driven.
+//#define FLUXAMA_HW_UART 2
+
+// Setup library on an SD card (SD_CS_PIN), next to the EEPROM setups.
+// tools/setuplib.cpp reads and writes the same file on a host.
+//#define SETUP_LIBRARY_SD 1
 
 #endif
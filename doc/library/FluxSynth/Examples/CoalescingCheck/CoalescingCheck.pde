@@ -0,0 +1,53 @@
+/* CoalescingCheck.pde
+ * Checks that coalescing in the transmit queue keeps RPN/NRPN writes
+ * apart: a parameter select is a barrier, a data entry must not be merged
+ * into the one of another parameter. The same writes are sent unqueued on
+ * channel 1 and queued on channel 2, the bytes must match but for the
+ * channel. The result goes to the serial monitor, nothing to the synth.
+ */
+
+#include <FluxSynth.h>
+
+FluxSynth synth;
+
+byte txBuffer[ 128 ];
+byte wire[ 2 ][ 64 ];
+byte wireLen[ 2 ];
+byte run = 0;
+
+bool captureByte( byte B ) { // Output routine for FluxSynth, into wire[run]
+  if (wireLen[ run ] < sizeof( wire[ run ] )) wire[ run ][ wireLen[ run ]++ ] = B;
+  return true;
+  }
+
+void sendWrites( byte Channel )
+{
+  synth.setTvFilter( Channel, 10, 20 );        // NRPN 01 20, 01 21
+  synth.RPN_Control( Channel, 0, 0, 2 );       // Bend range
+  synth.NRPN_Control( Channel, 0x37, 0x15, 5 );
+  synth.controlChange( Channel, 0x5B, 40 );    // Reverb send
+  synth.NRPN_Control( Channel, 0x37, 0x16, 6 );
+}
+
+void setup()
+{
+  Serial.begin( 9600 );
+  synth.sendByte = captureByte;
+
+  run = 0;
+  sendWrites( 0 );
+
+  run = 1;
+  synth.setTxQueue( txBuffer, sizeof( txBuffer ));
+  sendWrites( 1 );
+  synth.txFlush();
+
+  bool ok = wireLen[0] == wireLen[1];
+  for( byte i = 0; ok && i < wireLen[0]; ++i )
+    ok = (wire[0][i] ^ wire[1][i]) == ((wire[0][i] & 0x80) ? 1 : 0);
+  Serial.println( ok ? "PASS" : "FAIL" );
+}
+
+void loop()
+{
+}
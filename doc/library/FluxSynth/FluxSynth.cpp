@@ -57,29 +57,1288 @@ FluxSynth::FluxSynth(void)
     sendByte = nullSend;
     _runStat = 0;         // Midi running status
     _effects = EF_ALL;    // EF_REVERB, EF_SURROUND, EF_EQ_4BAND (+Chorus)
+    _txq.init( NULL, 0 ); // Unbuffered until setTxQueue
+    _rtq.init( NULL, 0 );
+    _thq.init( NULL, 0 );
+    _thStat = _thNeed = _thLen = 0;
+    _thSkip = false;
+    _thDirty = 0;
+    _thDirtyAll = false;
+    _route.zones = 0;
+    _rtHwParts = 0;
+    memset( _rtHeld, 0, sizeof( _rtHeld ));
+    _txKick = NULL;
+    _txMerge = true;
+    #ifdef USE_NOTE_TRACKING
+    memset( _pmPartReserve, 0, sizeof( _pmPartReserve ));
+    _pmPolicy = STEAL_OLDEST;
+    _pmHeadroom = 0;
+    _pmSteals = 0;
+    _pmInjLen = _pmInjPos = 0;
+    _pmCount = 0;
+    _pmSustain = 0;
+    memset( _pmKeys, 0, sizeof( _pmKeys ));
+    memset( _pmChCount, 0, sizeof( _pmChCount ));
+    for( byte p = 0; p < 16; ++p ) _pmPartCh[p] = p;
+    _pmDrumParts = 1 << 9;  // GM drums on part/channel 10
+    _pmParts();
+    #endif
+    _qStat = _qNeed = _qLen = 0;
+    _dLane = _dStat = _dNeed = 0;
+    _wireStat = 0;
+    _rtT0 = 0;
+    _settling = false;
+    _dSettle = 0;
+    _settleQueued = 0;
+    _settleMs = 0;
+    _settleT0 = 0;
+    _settleReset = 500;   // As the examples delay after GS_Reset
+    _settleFx = 50;
+    _txHiWater = 0;       // (No txResetStats, interrupts stay as they are)
+    _txStalls = 0;
+    _rtMaxWait = 0;
+    _txMerged = 0;
+    _txWait = 0;
+    _thOverruns = 0;
+    _thFanout = 0;
+    invalidateParamCache();
+    #ifdef USE_SHADOW_STATE
+    _shForce = false;
+    #endif
+    invalidateState();
+    _sxGather = 0;
+    _sxLen = 0;
+    _sxBlocks = true;
+    _sxMax = SX_BLOCK_MAX;
+    _bBuf = NULL;
+    _noteOffOn = false;
 }
 
 void FluxSynth::begin() 
 {
-    // nothing
-}
+    // nothing
+}
+
+// Raw output from the application. We can't tell what it does to the synth,
+// so forget the running status and the selected RPN/NRPN.
+
+void FluxSynth::writePort( byte b )
+{
+    _runStat = 0;
+    invalidateParamCache();
+    invalidateState();
+    _writePort( b );
+}
+
+void FluxSynth::writePort( byte *buf, word cnt )
+{
+    _runStat = 0;
+    invalidateParamCache();
+    invalidateState();
+    _writePort( buf, cnt );
+}
+
+void FluxSynth::_writePort( byte b )
+{
+    if (_sxLen) _sxFlush(); // Pending parameter block goes first
+    if (_bBuf)              // Batch in progress, just collect
+    {
+        _batchPut( b );
+        return;
+    }
+    if (_txq.buf) _txPut( b );
+    else sendByte( b );
+}
+
+void FluxSynth::_writePort( byte *buf, word cnt )
+{
+    for( word i=0; i < cnt; i++ ) _writePort( buf[ i ]);
+}
+
+// Data bytes following a channel status
+
+static byte _dataCount( byte Stat )
+{
+    byte cmd = MIDICMD( Stat );
+    return (cmd == ME_PROGCHANGE || cmd == ME_CHANTOUCH) ? 1 : 2;
+}
+
+// Follow the message structure of a byte stream. Stat is the running status
+// (0 if none), Need the data bytes still missing (FFh while in a sysex).
+// Returns true if B begins a message, which includes data bytes that start
+// a new message under running status.
+
+static bool _msgTrack( byte B, byte &Stat, byte &Need )
+{
+    if (B & 0x80)
+    {
+        if (B == ME_EOX) { Stat = Need = 0; return false; }
+        if (B < ME_SYSEX) { Stat = B; Need = _dataCount( B ); }
+        else { Stat = 0; Need = (B == ME_SYSEX) ? 0xFF : (B == ME_SETTLE) ? 2 : 0; }
+        return true;
+    }
+    if (Need == 0xFF) return false; // Sysex data
+    if (Need) { --Need; return false; }
+    if (Stat) { Need = _dataCount( Stat ) - 1; return true; }
+    return false;                   // Stray data byte
+}
+
+//-----------------------------------------------------------------------------
+// Batches
+// Between beginBatch and commit, output is collected in the caller's buffer
+// (every message with its status byte). commit reorders it to get the most
+// out of running status, and sends it:
+//
+// - Channels are sent one after the other, in order of first appearance.
+// - Within a channel, a message may move up to join an earlier message with
+//   the same status, if everything it passes commutes with it. Order between
+//   messages with the same status is always kept.
+// - Sysex and other system messages (resets, settle markers) are barriers:
+//   they keep their place, and messages are only reordered between them.
+//
+// If the buffer fills up, what's collected so far is sent as is, and the
+// rest of the batch goes out unbatched.
+//-----------------------------------------------------------------------------
+
+struct BatchMsg
+{
+    byte stat;  // Status byte
+    byte off;   // Offset of the first data byte (system msg: of the status)
+    byte len;   // Data bytes (system msg: total bytes)
+};
+
+#define BATCH_MAXMSG 32 // Max messages sorted per commit
+
+void FluxSynth::beginBatch( byte *Buffer, byte Size )
+{
+    if (_bBuf) commit();
+    _sxFlush();
+    _bBuf = Buffer;
+    _bSize = Size;
+    _bLen = 0;
+    _bRunStat = _runStat;
+    _bLastStat = _runStat;
+    _bNeed = 0;
+    _bMsgs = 0;
+}
+
+void FluxSynth::_batchPut( byte b )
+{
+    byte stat = _bLastStat, need = _bNeed;
+    bool start = _msgTrack( b, stat, need );
+
+    if (_bLen < _bSize && !(start && _bMsgs == BATCH_MAXMSG))
+    {
+        _bBuf[ _bLen++ ] = b;
+        _bNeed = need;
+        _bLastStat = stat;
+        if (start) ++_bMsgs;
+        return;
+    }
+    // Full, send what we have in original order and carry on unbatched
+    byte *buf = _bBuf;
+    _bBuf = NULL;
+    _runStat = _bRunStat;
+    _writePort( buf, _bLen );
+    _writePort( b );
+    _runStat = stat;
+}
+
+// Can two messages on the same channel trade places?
+
+static bool _commutes( byte S1, byte *D1, byte S2, byte *D2 )
+{
+    byte t1 = MIDICMD( S1 ), t2 = MIDICMD( S2 );
+    if (t1 == t2) return false; // Same status, order is kept anyway
+
+    bool n1 = t1 == ME_NOTEON || t1 == ME_NOTEOFF || t1 == ME_POLYTOUCH;
+    bool n2 = t2 == ME_NOTEON || t2 == ME_NOTEOFF || t2 == ME_POLYTOUCH;
+    if (n1 && n2) return D1[0] != D2[0];        // Different keys
+    if (n1 || n2) return false;                 // Notes vs controllers
+    if (t1 == ME_PROGCHANGE || t2 == ME_PROGCHANGE) return false;
+
+    // Left: controllers, channel aftertouch and pitch bend
+    byte cc = (t1 == ME_CONTROL) ? D1[0] : (t2 == ME_CONTROL) ? D2[0] : CT_WHEEL;
+    switch( cc )
+    {
+    case CT_BANKSELECT: case CT_BANKSEL_LSB:
+    case CT_DATAENTRY: case CT_DATAENT_LSB: case CT_DATAINC: case CT_DATADEC:
+    case CT_NONREG_LSB: case CT_NONREG_MSB: case CT_REG_LSB: case CT_REG_MSB:
+        return false;
+    }
+    return cc < CT_ALLSOUNDOFF; // Not mode messages
+}
+
+// Order the channel messages S..E-1: channel by channel in order of first
+// appearance, a message joins an earlier one with its status where it can
+
+static void _batchOrder( BatchMsg *msg, byte S, byte E, byte *buf, byte *order, byte &cnt )
+{
+    word chDone = 0;
+    for( byte m=S; m < E; ++m )
+    {
+        byte ch = MIDICHAN( msg[ m ].stat );
+        if (bitRead( chDone, ch )) continue;
+        bitSet( chDone, ch );
+
+        byte first = cnt;
+        for( byte k=m; k < E; ++k )
+        {
+            BatchMsg &mk = msg[ k ];
+            if (MIDICHAN( mk.stat ) != ch) continue;
+
+            byte at = cnt; // Default: append
+            for( byte j=cnt; j > first; --j )
+            {
+                BatchMsg &mj = msg[ order[ j-1 ]];
+                if (mj.stat == mk.stat) { at = j; break; }
+                if (!_commutes( mj.stat, &buf[ mj.off ], mk.stat, &buf[ mk.off ])) break;
+            }
+            for( byte j=cnt; j > at; --j ) order[ j ] = order[ j-1 ];
+            order[ at ] = k;
+            ++cnt;
+        }
+    }
+}
+
+word FluxSynth::commit()
+{
+    _sxFlush();
+    if (!_bBuf) return 0;   // Not batching, or overflowed
+
+    byte *buf = _bBuf;
+    byte len = _bLen;
+    _bBuf = NULL;
+    _runStat = _bRunStat;
+
+    // Split into messages
+
+    BatchMsg msg[ BATCH_MAXMSG ];
+    byte n = 0, stat = 0;
+    for( byte i=0; i < len; )
+    {
+        byte b = buf[ i ];
+        if (b >= ME_SYSEX)
+        {
+            byte j = i + 1;
+            if (b == ME_SYSEX) while (j < len && buf[ j++ ] != ME_EOX) ;
+            if (b == ME_SETTLE) j = (i + 3 < len) ? i + 3 : len;
+            msg[ n ].stat = b; msg[ n ].off = i; msg[ n++ ].len = j - i;
+            i = j;
+            stat = 0;
+            continue;
+        }
+        if (b & 0x80) { stat = b; ++i; }
+        if (!stat) { ++i; continue; } // Stray data byte, drop it
+        byte cnt = _dataCount( stat );
+        if (i + cnt > len) break;   // Incomplete, drop it
+        msg[ n ].stat = stat; msg[ n ].off = i; msg[ n++ ].len = cnt;
+        i += cnt;
+    }
+
+    // Wire bytes in original order
+
+    word before = 0;
+    stat = _runStat;
+    for( byte m=0; m < n; ++m )
+    {
+        if (msg[ m ].stat >= ME_SYSEX) { before += msg[ m ].len; stat = 0; }
+        else { before += msg[ m ].len + (msg[ m ].stat != stat); stat = msg[ m ].stat; }
+    }
+
+    // New order: between system messages, channel by channel
+
+    byte order[ BATCH_MAXMSG ], cnt = 0;
+    for( byte s=0; s <= n; ++s )
+    {
+        byte e = s;
+        while (e < n && msg[ e ].stat < ME_SYSEX) ++e;
+        _batchOrder( msg, s, e, buf, order, cnt );
+        if (e < n) order[ cnt++ ] = e;   // The barrier itself
+        s = e;
+    }
+
+    // Send
+
+    word after = 0;
+    for( byte k=0; k < cnt; ++k )
+    {
+        BatchMsg &mk = msg[ order[ k ]];
+        if (mk.stat >= ME_SYSEX)
+        {
+            _writePort( &buf[ mk.off ], mk.len );
+            _runStat = (mk.stat == ME_RESET) ? 0 : ME_SYSEX;
+            after += mk.len;
+        }
+        else
+        {
+            if (mk.stat != _runStat) ++after;
+            writeMidiCmd( mk.stat );
+            _writePort( &buf[ mk.off ], mk.len );
+            after += mk.len;
+        }
+    }
+    return before - after;
+}
+
+//-----------------------------------------------------------------------------
+// Transmit queues
+// Two lanes feed the wire. The real-time lane carries note on/off, pitch bend
+// and aftertouch, the bulk lane everything else. txNext picks the next
+// message from the real-time lane whenever it's between messages, so notes
+// wait for at most one bulk message (keep those short with setBulkUnit).
+//
+// Every queued message starts with its status byte, running status is
+// applied on the way out by txNext, where the actual order is known.
+//-----------------------------------------------------------------------------
+
+void FluxQueue::init( byte *Buffer, byte Size )
+{
+    buf = (Size > 1) ? Buffer : NULL;
+    size = Size;
+    head = tail = 0;
+}
+
+byte FluxQueue::pending()
+{
+    byte h = head, t = tail;
+    return (h >= t) ? h - t : size - t + h;
+}
+
+bool FluxQueue::put( byte B )
+{
+    byte next = head + 1;
+    if (next >= size) next = 0;
+    if (next == tail) return false;
+    buf[ head ] = B;
+    head = next;
+    return true;
+}
+
+int FluxQueue::get()
+{
+    byte t = tail;
+    if (t == head) return -1;
+    byte b = buf[ t ];
+    if (++t >= size) t = 0;
+    tail = t;
+    return b;
+}
+
+void FluxSynth::setTxQueue( byte *Buffer, byte Size, void (*Kick)() )
+{
+    txFlush(); // Don't lose what's already queued
+    _txq.init( Buffer, Size );
+    _txKick = Kick;
+    _qStat = _qNeed = _qLen = 0;
+    _dLane = _dStat = _dNeed = 0;
+    _wireStat = 0;
+    txResetStats();
+}
+
+void FluxSynth::setRtQueue( byte *Buffer, byte Size )
+{
+    txFlush();
+    _rtq.init( _txq.buf ? Buffer : NULL, Size ); // Needs the bulk lane
+}
+
+void FluxSynth::setBulkUnit( byte MaxBytes )
+{
+    _sxFlush();
+    // A DT1 packet has 10 bytes of header, address, checksum and EOX
+    _sxMax = (MaxBytes > 10 + SX_BLOCK_MAX) ? SX_BLOCK_MAX :
+             (MaxBytes > 10) ? MaxBytes - 10 : 1;
+}
+
+void FluxSynth::_qPut( FluxQueue &Q, byte b )
+{
+    if (!Q.put( b ))        // Queue full, have to wait for the wire
+    {
+        ++_txStalls;
+        unsigned long t0 = micros();
+        while (!Q.put( b ))
+        {
+            if (_txKick) _txKick(); // ISR drains, just wait
+            else txService( 1 );    // Polled, drain one byte ourselves
+        }
+        if (_txKick) _txWait += micros() - t0; // (else txService counted it)
+    }
+    word n = txPending();
+    if (n > _txHiWater) _txHiWater = n;
+    if (_txKick) _txKick();
+}
+
+// Bulk lane. Channel messages are assembled first, so they can be merged
+// into a queued one, and get their status back if sent with running status.
+
+void FluxSynth::_txPut( byte b )
+{
+    if (_msgTrack( b, _qStat, _qNeed ))
+    {
+        _qLen = 0;
+        if (!(b & 0x80)) _qMsg[ _qLen++ ] = _qStat;
+    }
+    if (_qStat && _qStat < ME_SYSEX && _qLen < 3)
+    {
+        _qMsg[ _qLen++ ] = b;
+        if (_qNeed || _coalesce( _txq, _qMsg, _qLen )) return;
+        for( byte i = 0; i < _qLen; ++i ) _qPut( _txq, _qMsg[i] );
+    }
+    else _qPut( _txq, b );
+}
+
+//-----------------------------------------------------------------------------
+// Settle time
+// Resets and the effect restart keep the SAM2195 busy for a while, and
+// what's sent meanwhile gets lost. Rather than delay(), a marker (F4 ll hh,
+// never sent) goes into the queue behind the command, and txNext holds all
+// output for that many ms once the command is out. Without a queue there's
+// no way around delay().
+//-----------------------------------------------------------------------------
+
+void FluxSynth::setSettleTime( word ResetMs, word EffectsMs )
+{
+    _settleReset = ResetMs;
+    _settleFx = EffectsMs;
+}
+
+boolean FluxSynth::settling()
+{
+    noInterrupts();
+    bool busy = _settleQueued || (_settling && (millis() - _settleT0 < _settleMs));
+    interrupts();
+    return busy;
+}
+
+void FluxSynth::_settle( word Ms )
+{
+    if (!Ms) return;
+    if (!_txq.buf)
+    {
+        delay( Ms );
+        return;
+    }
+    if (Ms > 0x3FFF) Ms = 0x3FFF;
+    byte marker[3] = { ME_SETTLE, byte( Ms & 0x7F ), byte( Ms >> 7 ) };
+    noInterrupts();
+    ++_settleQueued;
+    interrupts();
+    _writePort( marker, 3 );
+}
+
+//-----------------------------------------------------------------------------
+// MIDI thru / merge
+// Bytes received from a MIDI input are parsed as they come in and
+// forwarded as complete messages through a third lane, so neither stream
+// is ever split: the drain only switches lanes between messages.
+// Running status in the input is expanded, system real-time and system
+// common messages are dropped (the SAM2195 ignores them anyway).
+//
+// thruByte is meant to be called from the UART receive interrupt. With an
+// interrupt driven output (see setTxQueue's Kick) a message then waits for
+// at most the one on the wire, independent of the main loop.
+//
+// Controllers and programs received that way change the synth state behind
+// our back, the affected channels drop their cached state (see _thruSync).
+//-----------------------------------------------------------------------------
+
+void FluxSynth::setThruQueue( byte *Buffer, byte Size )
+{
+    txFlush();
+    noInterrupts();
+    _thq.init( _txq.buf ? Buffer : NULL, Size ); // Needs the bulk lane
+    _thStat = _thNeed = _thLen = 0;
+    _thSkip = false;
+    interrupts();
+}
+
+// Put a byte into the thru lane. Never waits, what doesn't fit is dropped.
+
+bool FluxSynth::_thPut( byte b, byte Reserve )
+{
+    byte free = _thq.size - 1 - _thq.pending();
+    if (free <= Reserve || !_thq.put( b ))
+    {
+        ++_thOverruns;
+        return false;
+    }
+    return true;
+}
+
+void FluxSynth::thruByte( byte B )
+{
+    if (!_thq.buf || B >= 0xF8) return; // System real-time
+
+    bool inSysex = (_thNeed == 0xFF);
+    _thT = millis();
+    if (inSysex && (B & 0x80) && B != ME_EOX)
+        _thEndSysex();                          // Cut short by a new message
+    if (_msgTrack( B, _thStat, _thNeed ))
+    {
+        _thLen = 0;
+        if (!(B & 0x80)) _thMsg[ _thLen++ ] = _thStat;
+    }
+    if (_thStat && _thStat < ME_SYSEX)          // Channel message
+    {
+        if (_thLen < 3) _thMsg[ _thLen++ ] = B;
+        if (_thNeed) return;
+        _thRoute();
+    }
+    else if (B == ME_SYSEX)
+    {
+        _thSkip = !_thPut( B, 1 );
+        _thDirtyAll = true;
+    }
+    else if (_thNeed == 0xFF)                   // Sysex data
+    {
+        // Keep a byte for the EOX, the drain waits for it
+        if (!_thSkip && !_thPut( B, 1 )) _thEndSysex();
+    }
+    else if (B == ME_EOX && inSysex)
+    {
+        if (!_thSkip) _thPut( B, 0 );
+    }
+    else return;                                // System common, stray data
+    if (_txKick) _txKick();
+}
+
+// The drain holds the other lanes until the thru sysex is complete, so
+// one that won't be has to be ended here. The rest of it is dropped.
+
+void FluxSynth::_thEndSysex()
+{
+    if (!_thSkip) _thPut( ME_EOX, 0 ); // Always fits, see the reserve above
+    _thSkip = true;
+}
+
+//-----------------------------------------------------------------------------
+// Thru routing
+// Messages on the routed input channel are sent to the zones instead.
+// Note messages go to the zones whose key range holds the key (a 4 bit
+// zone mask per key, so that's a table lookup), everything else goes
+// once to each zone channel. Other channels pass unchanged.
+//
+// A hardware layer zone costs no bytes at all: its part is set to listen
+// to the input channel (setPartChannel), and the message is forwarded
+// once, unchanged. Its key range, transpose and velocity don't apply.
+//-----------------------------------------------------------------------------
+
+void FluxSynth::setThruRouting( const FluxRouting &Routing )
+{
+    FluxRouting route = Routing, old;
+    byte keys[64], held[16], in = route.inChannel;
+    word chans = 0, hwParts = 0;
+    bool hw = false;
+
+    // Anything out of range (e.g. 0xFF from erased EEPROM) is no routing
+    if (in > 15 || route.zones > ROUTE_MAX_ZONES) route.zones = 0;
+    for( byte z = 0; z < route.zones; ++z )
+    {
+        FluxZone &zone = route.zone[z];
+        if ((zone.channel & ~ZONE_HWLAYER) > 15 || zone.lowKey > zone.highKey 
+            || zone.highKey > 127) route.zones = 0;
+    }
+
+    memset( keys, 0, sizeof( keys ));
+    for( byte z = 0; z < route.zones; ++z )
+    {
+        FluxZone &zone = route.zone[z];
+        if (zone.channel & ZONE_HWLAYER)
+        {
+            hwParts |= 1 << MIDICHAN( zone.channel );
+            if (hw) continue;   // One unchanged copy serves all layers
+            hw = true;
+            zone.lowKey = 0; zone.highKey = 127;
+            zone.channel = in; zone.transpose = 0; zone.velocity = 0;
+        }
+        for( byte k = zone.lowKey; k <= zone.highKey; ++k )
+            keys[ k >> 1 ] |= (1 << z) << ((k & 1) << 2);
+        chans |= 1 << MIDICHAN( zone.channel );
+    }
+    noInterrupts();
+    old = _route;
+    memcpy( held, _rtHeld, sizeof( held ));
+    memset( _rtHeld, 0, sizeof( _rtHeld ));
+    _route = route;
+    memcpy( _rtKeys, keys, sizeof( keys ));
+    _rtChans = chans;
+    interrupts();
+
+    // Notes held through the old zones end there, layered parts included
+    for( byte k = 0; k < 128; ++k )
+    {
+        if (!(held[ k >> 3 ] & (1 << (k & 7)))) continue;
+        for( byte z = 0; z < old.zones; ++z )
+        {
+            FluxZone &zone = old.zone[z];
+            int t = k + zone.transpose;
+            if ((zone.channel & ZONE_HWLAYER) || k < zone.lowKey || k > zone.highKey 
+                || t < 0 || t > 127) continue;
+            noteOff( zone.channel, t );
+        }
+    }
+
+    // Parts layered by the old routing listen to their own channel again
+    for( byte part = 0; part < 16; ++part )
+    {
+        if (hwParts & (1 << part))           setPartChannel( part, in );
+        else if (_rtHwParts & (1 << part))   setPartChannel( part, part );
+    }
+    _rtHwParts = hwParts;
+}
+
+// Queue the assembled thru message (_thMsg), routed. Runs in thruByte.
+
+void FluxSynth::_thRoute()
+{
+    byte out[ ROUTE_MAX_ZONES ][3];
+    byte stat = _thMsg[0], cmd = MIDICMD( stat ), len = _thLen, n = 0;
+    bool held = false;
+
+    if (!_route.zones || MIDICHAN( stat ) != MIDICHAN( _route.inChannel ))
+    {
+        memcpy( out[0], _thMsg, 3 );
+        n = 1;
+    }
+    else if (cmd <= ME_POLYTOUCH)   // Note messages, by key range
+    {
+        byte key = _thMsg[1];
+        held = cmd != ME_POLYTOUCH;
+        byte mask = (_rtKeys[ key >> 1 ] >> ((key & 1) << 2)) & 0x0F;
+        for( byte z = 0; mask; ++z, mask >>= 1 )
+        {
+            if (!(mask & 1)) continue;
+            FluxZone &zone = _route.zone[z];
+            int k = key + zone.transpose;
+            if (k < 0 || k > 127) continue;
+            byte vel = _thMsg[2];
+            if (cmd == ME_NOTEON && vel && zone.velocity)
+            {
+                word v = (word( vel ) * zone.velocity) >> 6;
+                vel = (v > 127) ? 127 : v ? v : 1;
+            }
+            out[n][0] = cmd | MIDICHAN( zone.channel );
+            out[n][1] = k;
+            out[n][2] = vel;
+            ++n;
+        }
+    }
+    else                            // Everything else, once per zone channel
+    {
+        for( byte ch = 0; ch < 16 && n < ROUTE_MAX_ZONES; ++ch )
+            if (_rtChans & (1 << ch))
+            {
+                out[n][0] = cmd | ch;
+                out[n][1] = _thMsg[1];
+                out[n][2] = _thMsg[2];
+                ++n;
+            }
+    }
+    if (!n) return;
+
+    // All copies or none
+    byte free = _thq.size - 1 - _thq.pending();
+    if (free < n * len)
+    {
+        ++_thOverruns;
+        return;
+    }
+    for( byte i = 0; i < n; ++i )
+    {
+        for( byte j = 0; j < len; ++j ) _thq.put( out[i][j] );
+        if (cmd == ME_CONTROL || cmd == ME_PROGCHANGE)
+            _thDirty |= 1 << MIDICHAN( out[i][0] );
+    }
+    _thFanout += (n - 1) * len;
+
+    // Keys held through the zones, for setThruRouting
+    if (held)
+    {
+        byte key = _thMsg[1], b = 1 << (key & 7);
+        if (cmd == ME_NOTEON && _thMsg[2]) _rtHeld[ key >> 3 ] |= b;
+        else                               _rtHeld[ key >> 3 ] &= byte( ~b );
+    }
+}
+
+word FluxSynth::thruFanout()
+{
+    noInterrupts();
+    word n = _thFanout;
+    interrupts();
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+// Polyphony manager
+// txNext looks at every note and controller message before it goes out,
+// whatever lane it came from, so the tracking follows the wire order.
+// A stolen note's note off is sent right before the note on that needs
+// the voice.
+//-----------------------------------------------------------------------------
+
+// Also runs in txNext, which may be the UART interrupt: interrupts stay
+// as they were.
+
+void FluxSynth::_pmClear()
+{
+    #ifdef USE_NOTE_TRACKING
+    byte sreg = SREG;
+    noInterrupts();
+    memset( _pmKeys, 0, sizeof( _pmKeys ));
+    memset( _pmChCount, 0, sizeof( _pmChCount ));
+    _pmCount = 0;
+    _pmSustain = 0;
+    for( byte p = 0; p < 16; ++p ) _pmPartCh[p] = p; // GS defaults
+    _pmDrumParts = 1 << 9;  // Drums on part 10
+    _pmParts();
+    SREG = sreg;
+    #endif
+}
+
+#ifdef USE_NOTE_TRACKING
+
+void FluxSynth::setStealPolicy( byte Policy, byte Headroom )
+{
+    _pmPolicy = Policy;
+    _pmHeadroom = Headroom;
+}
+
+// Voices left by the enabled effects
+
+byte FluxSynth::voiceBudget()
+{
+    byte n = PM_MAX_NOTES;
+    if (_effects & EF_REVERB) n -= 13;
+    if (_effects & EF_SURROUND) n -= 2;
+    if ((_effects & EF_EQ_4BAND) == EF_EQ_4BAND) n -= 8;
+    else if (_effects & EF_EQ_2BAND) n -= 4;
+    return (n > _pmHeadroom) ? n - _pmHeadroom : 1;
+}
+
+byte FluxSynth::activeNotes()
+{
+    return _pmCount;
+}
+
+boolean FluxSynth::isNoteOn( byte Channel, byte Key )
+{
+    return _pmKeys[ MIDICHAN( Channel )][ MIDIDATA( Key ) >> 3 ] & (1 << (Key & 7));
+}
+
+word FluxSynth::voiceSteals()
+{
+    noInterrupts();
+    word n = _pmSteals;
+    interrupts();
+    return n;
+}
+
+// Channel drum flags and voice reserves from the part settings
+
+void FluxSynth::_pmParts()
+{
+    _pmDrums = 0;
+    memset( _pmReserve, 0, sizeof( _pmReserve ));
+    for( byte p = 0; p < 16; ++p )
+    {
+        byte ch = _pmPartCh[p];
+        if (ch > 15) continue;
+        if (_pmDrumParts & (1 << p)) _pmDrums |= 1 << ch;
+        _pmReserve[ ch ] += _pmPartReserve[p];
+    }
+}
+
+// Release what's sounding, queued notes first go out so they're known.
+// Unqueued notes aren't tracked, all notes off it is then.
+
+void FluxSynth::panic()
+{
+    if (!_txq.buf)
+    {
+        for( byte ch = 0; ch < 16; ++ch ) allNotesOff( ch );
+        return;
+    }
+    txFlush();
+    for( byte ch = 0; ch < 16; ++ch )
+    {
+        byte keys[16];
+        noInterrupts();
+        memcpy( keys, _pmKeys[ ch ], 16 );
+        bool held = _pmSustain & (1 << ch);
+        interrupts();
+        if (held) controlChange( ch, CT_DAMPER, 0 );
+        for( byte k = 0; k < 128; ++k )
+            if (keys[ k >> 3 ] & (1 << (k & 7))) noteOff( ch, k );
+    }
+}
+
+// Look at the message about to go out of Q. Returns false if it's
+// a note or controller that isn't completely queued yet.
+
+bool FluxSynth::_pmCheck( FluxQueue &Q )
+{
+    byte t = Q.tail, stat = Q.buf[ t ];
+    byte cmd = MIDICMD( stat ), ch = MIDICHAN( stat );
+    if (cmd != ME_NOTEON && cmd != ME_NOTEOFF && cmd != ME_CONTROL) return true;
+    if (Q.pending() < 3) return false;
+    if (++t >= Q.size) t = 0;
+    byte d1 = Q.buf[ t ];
+    if (++t >= Q.size) t = 0;
+    byte d2 = Q.buf[ t ];
+
+    if (cmd == ME_CONTROL)
+    {
+        if (d1 == CT_DAMPER)
+        {
+            if (d2 >= 64) _pmSustain |= 1 << ch;
+            else
+            {
+                _pmSustain &= ~(1 << ch);
+                for( byte i = _pmCount; i--; )  // Let go of the held notes
+                    if (_pmList[i].chan == (ch | PM_HELD)) _pmRemove( i );
+            }
+        }
+        else if (d1 == CT_ALLSOUNDOFF || d1 == CT_ALLNOTESOFF) _pmClearChannel( ch );
+    }
+    else if (!(_pmDrums & (1 << ch)))
+    {
+        if (cmd == ME_NOTEON && d2) _pmNoteOn( ch, d1, d2 );
+        else _pmNoteOff( ch, d1, false );
+    }
+    return true;
+}
+
+void FluxSynth::_pmNoteOn( byte Chan, byte Key, byte Vel )
+{
+    byte bit = 1 << (Key & 7), *keys = &_pmKeys[ Chan ][ Key >> 3 ];
+    if (*keys & bit)            // Sounding already
+    {
+        for( byte i = 0; i < _pmCount; ++i )
+            if ((_pmList[i].chan & 0x0F) == Chan && _pmList[i].key == Key)
+            {
+                if (_pmPolicy == STEAL_SAMEKEY) _pmSteal( i );
+                else _pmRemove( i ); // Re-added as the newest below
+                break;
+            }
+    }
+    else if (_pmPolicy != STEAL_NONE && _pmCount >= voiceBudget())
+    {
+        _pmSteal( _pmVictim() );
+    }
+    if (_pmCount >= PM_MAX_NOTES) _pmUnlist( 0 ); // Untracked, bitmap still knows
+    _pmList[ _pmCount ].chan = Chan;
+    _pmList[ _pmCount ].key = Key;
+    _pmList[ _pmCount ].vel = Vel;
+    ++_pmCount;
+    ++_pmChCount[ Chan ];
+    *keys |= bit;
+}
+
+// Force: remove even if the damper holds it
+
+void FluxSynth::_pmNoteOff( byte Chan, byte Key, bool Force )
+{
+    byte bit = 1 << (Key & 7), *keys = &_pmKeys[ Chan ][ Key >> 3 ];
+    if (!(*keys & bit)) return;
+    for( byte i = 0; i < _pmCount; ++i )
+        if ((_pmList[i].chan & 0x0F) == Chan && _pmList[i].key == Key)
+        {
+            if ((_pmSustain & (1 << Chan)) && !Force)
+            {
+                _pmList[i].chan |= PM_HELD;
+                return;
+            }
+            _pmRemove( i ); 
+            return;
+        }
+    *keys &= ~bit;  // Not in the list (overflow)
+}
+
+void FluxSynth::_pmRemove( byte Index )
+{
+    PolyNote n = _pmList[ Index ];
+    _pmKeys[ n.chan & 0x0F ][ n.key >> 3 ] &= ~(1 << (n.key & 7));
+    _pmUnlist( Index );
+}
+
+// Drop a note from the list only, the bitmap keeps it for note off and panic
+
+void FluxSynth::_pmUnlist( byte Index )
+{
+    --_pmChCount[ _pmList[ Index ].chan & 0x0F ];
+    --_pmCount;
+    memmove( &_pmList[ Index ], &_pmList[ Index + 1 ], (_pmCount - Index) * sizeof( PolyNote ));
+}
+
+// Send a note off for the note ahead of the message in progress
+
+void FluxSynth::_pmSteal( byte Index )
+{
+    _pmInj[0] = ME_NOTEOFF | (_pmList[ Index ].chan & 0x0F);
+    _pmInj[1] = _pmList[ Index ].key;
+    _pmInj[2] = VEL_MEZZOPIANO;
+    _pmInjLen = 3;
+    _pmInjPos = 0;
+    _pmRemove( Index );
+    ++_pmSteals;
+}
+
+byte FluxSynth::_pmVictim()
+{
+    byte i, best = 0xFF;
+    for( i = 0; i < _pmCount; ++i )     // Released, held by the damper
+        if (_pmList[i].chan & PM_HELD) return i;
+
+    if (_pmPolicy == STEAL_QUIETEST)
+    {
+        for( i = 0; i < _pmCount; ++i )
+        {
+            byte ch = _pmList[i].chan;
+            if (_pmChCount[ ch ] <= _pmReserve[ ch ]) continue;
+            if (best == 0xFF || _pmList[i].vel < _pmList[ best ].vel) best = i;
+        }
+    }
+    else for( i = 0; i < _pmCount; ++i )
+    {
+        byte ch = _pmList[i].chan;
+        if (_pmChCount[ ch ] > _pmReserve[ ch ]) return i;
+    }
+    return (best == 0xFF) ? 0 : best; // Everyone within reserve, oldest
+}
+
+void FluxSynth::_pmClearChannel( byte Chan )
+{
+    for( byte i = _pmCount; i--; )
+        if ((_pmList[i].chan & 0x0F) == Chan) _pmRemove( i );
+    memset( _pmKeys[ Chan ], 0, 16 );
+}
+
+#else
+
+void FluxSynth::setStealPolicy( byte Policy, byte Headroom ) {}
+byte FluxSynth::voiceBudget() { return 64; }
+byte FluxSynth::activeNotes() { return 0; }
+boolean FluxSynth::isNoteOn( byte Channel, byte Key ) { return false; }
+word FluxSynth::voiceSteals() { return 0; }
+
+void FluxSynth::panic() // Don't know what's sounding
+{
+    for( byte ch = 0; ch < 16; ++ch ) allNotesOff( ch );
+}
+
+#endif //def USE_NOTE_TRACKING
+
+//-----------------------------------------------------------------------------
+// Coalescing
+// A controller or pitch bend value that hasn't gone out yet is simply
+// overwritten by a newer one for the same target, rather than queueing
+// both. That keeps the queue (and the lag) short while sweeping a pot.
+// NRPN sweeps benefit too, since the parameter cache reduces them to
+// plain data entry messages.
+//
+// A merge must not move the new value across anything that depends on
+// the old one, so the search restarts behind any sysex, program change
+// or structural controller (bank, RPN/NRPN select, switches, mode) on
+// the same channel. Notes are no barrier, a note may start with the
+// newer value.
+//-----------------------------------------------------------------------------
+
+void FluxSynth::setCoalescing( bool On )
+{
+    _txMerge = On;
+}
 
-void FluxSynth::writePort( byte b )
+// Continuous controllers, the only ones merged
+
+static bool _ccMergeable( byte CtrlNr )
 {
-    sendByte( b );
+    return !(CtrlNr == CT_BANKSELECT || CtrlNr == CT_BANKSEL_LSB
+        || CtrlNr == CT_DATAENT_LSB || CtrlNr >= CT_DATAINC
+        || (CtrlNr >= CT_DAMPER && CtrlNr <= CT_GEN_SW4));
 }
-
-void FluxSynth::writePort( byte *buf, word cnt )
-{
-    for( word i=0; i < cnt; i++ ) writePort( buf[ i ]);
+
+bool FluxSynth::_coalesce( FluxQueue &Q, byte *Msg, byte Len )
+{
+    byte stat = Msg[0], cmd = MIDICMD( stat );
+    if (!_txMerge) return false;
+    if (cmd == ME_CONTROL) { if (Len != 3 || !_ccMergeable( Msg[1] )) return false; }
+    else if (cmd != ME_PITCHBEND || Len != 3) return false;
+
+    noInterrupts(); // Consistent snapshot of the drain
+    byte t = Q.tail;
+    bool skip = _dNeed && _dLane == ((&Q == &_rtq) ? 1 : 2);
+    interrupts();
+    byte h = Q.head;
+    if (t == h) return false;
+
+    // Scan forward, remember the value of the last match behind the last barrier.
+    // The message being sent right now is skipped. k counts the data bytes of
+    // a message, running status included, k == 1 is a controller number.
+    byte i = t, off = 0, found = 0xFF, mst = 0, k = 0, len = 2;
+    for( ; i != h; (++i >= Q.size) ? i = 0 : 0, ++off )
+    {
+        byte b = Q.buf[ i ];
+        if (skip)
+        {
+            if (!(b & 0x80) || b == ME_EOX) continue;
+            skip = false;
+        }
+        if (b & 0x80)
+        {
+            mst = b; k = 0;
+            len = (MIDICMD( b ) == ME_PROGCHANGE || MIDICMD( b ) == ME_CHANTOUCH) ? 1 : 2;
+            if (b >= ME_SYSEX) found = 0xFF;
+            else if (MIDICHAN( b ) == MIDICHAN( stat ) && MIDICMD( b ) == ME_PROGCHANGE)
+                found = 0xFF;
+            continue;
+        }
+        if (mst >= ME_SYSEX) continue;
+        if (k == len) k = 0;
+        if (++k != 1 || MIDICHAN( mst ) != MIDICHAN( stat )) continue;
+        // Parameter selects and switches first, whatever the status
+        if (MIDICMD( mst ) == ME_CONTROL
+            && (!_ccMergeable( b ) || (cmd == ME_PITCHBEND && b == CT_DATAENTRY)))
+            found = 0xFF;
+        else if (mst == stat)
+        {
+            if (cmd == ME_PITCHBEND) found = off;
+            else if (b == Msg[1]) found = off + 1;
+        }
+    }
+    if (found == 0xFF) return false;
+
+    // Overwrite unless the drain got there in the meantime
+    bool ok;
+    i = t + found;
+    if (i >= Q.size || i < t) i -= Q.size;
+    noInterrupts();
+    byte done = Q.tail - t;
+    if (Q.tail < t) done += Q.size;
+    if ((ok = (done <= found)))
+    {
+        if (cmd == ME_PITCHBEND)
+        {
+            Q.buf[ i ] = Msg[1];
+            if (++i >= Q.size) i = 0;
+        }
+        Q.buf[ i ] = Msg[ 2 ];
+    }
+    interrupts();
+    if (ok) ++_txMerged;
+    return ok;
+}
+
+// Real-time lane (bulk lane or direct output if there is none)
+
+void FluxSynth::_voiceMsg( byte Cmd, byte D1, byte D2, byte Len )
+{
+    if (_rtq.buf && !_bBuf)
+    {
+        byte msg[3] = { Cmd, D1, D2 };
+        if (_coalesce( _rtq, msg, Len + 1 )) return;
+        if (_rtq.empty())
+        {
+            unsigned long now = micros();
+            noInterrupts(); // txNext updates it too
+            _rtT0 = now;
+            interrupts();
+        }
+        _qPut( _rtq, Cmd );
+        _qPut( _rtq, D1 );
+        if (Len > 1) _qPut( _rtq, D2 );
+        return;
+    }
+    byte data[2] = { D1, D2 };
+    writeMidiCmd( Cmd );
+    _writePort( data, Len );
+}
+
+// Pop the next byte for the wire, or -1 if there is nothing to send.
+// Safe to call from a UART data-register-empty ISR.
+
+int FluxSynth::txNext()
+{
+    for(;;)
+    {
+        int b;
+        #ifdef USE_NOTE_TRACKING
+        if (_pmInjLen)  // Note off for a stolen voice
+        {
+            b = _pmInj[ _pmInjPos++ ];
+            if (_pmInjPos >= _pmInjLen) _pmInjLen = 0;
+        }
+        else
+        #endif
+        {
+            if (!_dLane)    // Between messages, thru and real-time lanes first
+            {
+                if (_settling)  // Synth still busy, hold everything
+                {
+                    if (millis() - _settleT0 < _settleMs) return -1;
+                    _settling = false;
+                }
+                byte lane = (_thq.buf && !_thq.empty()) ? 3 
+                    : (_rtq.buf && !_rtq.empty()) ? 1 
+                    : (_txq.buf && !_txq.empty()) ? 2 : 0;
+                if (!lane) return -1;
+                #ifdef USE_NOTE_TRACKING
+                if (!_pmCheck( _lane( lane ))) return -1; // Note not complete yet
+                #endif
+                if (lane == 1)
+                {
+                    unsigned long now = micros();
+                    if (now - _rtT0 > _rtMaxWait) _rtMaxWait = now - _rtT0;
+                    _rtT0 = now; // Anything queued behind waits from here
+                }
+                _dLane = lane;
+                continue;
+            }
+            b = _lane( _dLane ).get();
+            if (b < 0)      // Rest of the message isn't queued yet
+            {
+                if (_dLane != 3 || _dNeed != 0xFF) return -1;
+                // Thru sysex, input may be gone (cable pulled)
+                byte sreg = SREG;
+                noInterrupts();
+                b = _thq.get();
+                if (b < 0 && millis() - _thT >= THRU_SYSEX_TIMEOUT)
+                {
+                    _thSkip = true;
+                    b = ME_EOX;
+                }
+                SREG = sreg;
+                if (b < 0) return -1;
+            }
+
+            _msgTrack( b, _dStat, _dNeed );
+            if (!_dNeed) _dLane = 0; // Message complete
+
+            if (b == ME_SETTLE) // Marker, not sent
+            {
+                if (_settleQueued) --_settleQueued;
+                _dSettle = 2;
+                continue;
+            }
+            if (_dSettle && !(b & 0x80))
+            {   // Settle time, low 7 bits first
+                if (--_dSettle) _settleMs = b;
+                else
+                {
+                    _settleMs |= word( b ) << 7;
+                    _settleT0 = millis();
+                    _settling = true;
+                }
+                continue;
+            }
+            _dSettle = 0;
+        }
+        if (b >= ME_SYSEX)
+        {
+            _wireStat = 0;
+            if (b == ME_RESET) _pmClear();
+        }
+        else if (b & 0x80)
+        {
+            if (b == _wireStat) continue; // Running status
+            _wireStat = b;
+        }
+        return b;
+    }
+}
+
+// Drain up to MaxBytes through sendByte. Returns the number of bytes sent.
+
+word FluxSynth::txService( word MaxBytes )
+{
+    if (_txKick)    // Interrupt driven, just make sure it runs
+    {
+        if (txPending()) _txKick();
+        return 0;
+    }
+    word n = 0;
+    int b;
+    unsigned long t0 = micros();
+    while (n < MaxBytes && (b = txNext()) >= 0)
+    {
+        sendByte( byte( b ));
+        ++n;
+    }
+    if (n) _txWait += micros() - t0;
+    return n;
+}
+
+// Block until everything queued has been handed over.
+
+void FluxSynth::txFlush()
+{
+    while ((_txq.buf && !_txq.empty()) || (_rtq.buf && !_rtq.empty())
+        || (_thq.buf && !_thq.empty()))
+    {
+        if (_txKick) _txKick();
+        else txService();
+    }
+}
+
+word FluxSynth::txPending()
+{
+    return word( _txq.buf ? _txq.pending() : 0 ) + (_rtq.buf ? _rtq.pending() : 0)
+        + (_thq.buf ? _thq.pending() : 0);
+}
+
+byte FluxSynth::txFree()
+{
+    return _txq.buf ? _txq.size - 1 - _txq.pending() : 0;
+}
+
+word FluxSynth::thruOverruns()
+{
+    noInterrupts();
+    word n = _thOverruns;
+    interrupts();
+    return n;
+}
+
+word FluxSynth::txMerged()
+{
+    noInterrupts();
+    word n = _txMerged;
+    interrupts();
+    return n;
+}
+
+unsigned long FluxSynth::rtMaxWait()
+{
+    noInterrupts();
+    unsigned long w = _rtMaxWait;
+    interrupts();
+    return w;
+}
+
+void FluxSynth::txResetStats()
+{
+    noInterrupts();
+    _txHiWater = txPending();
+    _txStalls = 0;
+    _rtMaxWait = 0;
+    _txMerged = 0;
+    _txWait = 0;
+    _thOverruns = 0;
+    _thFanout = 0;
+    interrupts();
 }
 
 void FluxSynth::writeMidiCmd( byte Cmd )
 {
-    if (Cmd != _runStat)    // MIDI running status changed
+    if (_bBuf) _writePort( Cmd ); // Batches keep every status, commit sorts it out
+    else if (_txq.buf)            // Queued, txNext does the running status
+    {
+        _runStat = Cmd;
+        _writePort( Cmd );
+    }
+    else if (Cmd != _runStat)     // MIDI running status changed
     {
         _runStat = Cmd;
-        writePort( Cmd );   // Write new command byte
+        _writePort( Cmd );  // Write new command byte
     }                       // else we're done!
 }
 
@@ -93,36 +1352,181 @@ void FluxSynth::sendParameterData( byte *data, word length )
     // All but two of the sysex blocks that Atmel Dream 2195 respond to
     // use a common Roland GS compatible header, so it's hard coded here.
     // All invokations must skip the header, and the tailing sysex end (0xF7)
+    // 'data' array begin with two address bytes followed by parameter data.
 
-    byte head[6] =   // (Field comments assume GS packet compatibility)
+    if (length < 2) return;
+    if (data[0] == 0x00 && data[1] == 0x7F)
+    {
+        invalidateParamCache(); // GS reset (40 00 7F)
+        invalidateState();
+        _pmClear();
+    }
+    else if (length > 2)        // Skip if every value is already set
+    {
+        bool skip = true;
+        for( word i=2; i < length; ++i ) 
+            if (!_shadowed( _sxSlot( data[0], data[1] + i-2 ), data[i] )) skip = false;
+        if (skip) return;
+        #ifdef USE_SHADOW_STATE
+        if (data[0] == 0x01 && (data[1] == 0x30 || data[1] == 0x38))
+        {   // Reverb/chorus program is a macro, it presets the following 7 parameters
+            for( byte a = data[1] + 1; a <= data[1] + 7; ++a )
+            {
+                byte *slot = _sxSlot( 0x01, a );
+                if (slot) *slot = SHADOW_UNKNOWN;
+            }
+        }
+        #endif
+    }
+
+    if (length == 3 && _sxGather && _sxBlockOk( data[0], data[1] ))
+        _sxAdd( data[0], data[1], data[2] );
+    else
+        _sendDT1( data[0], data[1], &data[2], length - 2, data[0] == 0x00 );
+}
+
+//# Send a GS DT1 packet: F0 41 00 42 12 40 mm ll dd..dd cs F7
+// The Roland checksum is the 7 bit two's complement of the sum of the
+// address and data bytes, accumulated as the bytes go out.
+// More than _sxMax data bytes go out as several packets at the following
+// addresses (see setBulkUnit), unless the write has to be Whole.
+
+void FluxSynth::_sendDT1( byte AddrMid, byte AddrLo, byte *Data, word Count, bool Whole )
+{
+    while (!Whole && Count > _sxMax)
+    {
+        _sendDT1( AddrMid, AddrLo, Data, _sxMax, true );
+        Data += _sxMax;
+        Count -= _sxMax;
+        AddrLo += _sxMax;
+        if (AddrLo & 0x80)  // 7 bit address bytes
+        {
+            AddrLo &= 0x7F;
+            ++AddrMid;
+        }
+    }
+
+    byte head[8] =   // (Field comments assume GS packet compatibility)
     {
         ME_SYSEX,    // F0h
         SXID_ROLAND, // Roland id (41h)
         0x00,        // Device nr
         SXM_GS,      // Model id (GS)
         0x12,        // Command id (DT1 - Data One Way) 
-        0x40         // Parameter address MSB
-        // 'data' array begin with two address bytes
-        // followed by parameter data
-    };
-    byte tail[2] = 
-    { 
-        0x00,       // Checksum (ignored by 2195; transmit for compatibilty)
-        ME_EOX      // End of exclusive
+        0x40,        // Parameter address MSB
+        AddrMid, AddrLo
     };
+    byte sum = 0x40 + AddrMid + AddrLo;
+
     _runStat = ME_SYSEX;
-    
-    #ifdef USE_SYSEX_CHKSUM // Calculate the Roland checksum
-    byte i, chkSum = 0x40; // Parameter address MSB is first chksum data
-    for( i=0; i < length; ++i ) chkSum += Data[ i ];
-    chkSum &= 0x7F; // Remainder of 'chkSum % 128'
-    chkSum ^= 0x7F; // Invert the lower 7 bits
-    tail[0] = chkSum;
-    #endif
-    
-    writePort( head, 6 );
-    writePort( data, length );
-    writePort( tail, 2 );
+    _writePort( head, 8 );
+    for( word i=0; i < Count; ++i )
+    {
+        sum += Data[ i ];
+        _writePort( Data[ i ]);
+    }
+    _writePort( byte( 0x80 - (sum & 0x7F)) & 0x7F ); // Checksum (ignored by 2195)
+    _writePort( ME_EOX );
+}
+
+//# Parameter block gathering
+// Between beginParameterBlock and endParameterBlock, single parameter writes
+// to neighbouring addresses are collected and sent as one DT1 packet.
+// Small gaps are filled in from the shadow state when the values are known.
+// Any other output flushes the block first, so the order on the wire is kept.
+
+#define SX_GAP_MAX  2   // Max unknown-to-us addresses bridged with shadow values
+
+void FluxSynth::beginParameterBlock()
+{
+    ++_sxGather;
+}
+
+void FluxSynth::endParameterBlock()
+{
+    if (_sxGather && --_sxGather == 0) _sxFlush();
+}
+
+void FluxSynth::enableBlockSysex( boolean On )
+{
+    _sxFlush();
+    _sxBlocks = On;
+}
+
+// Parameters that have to go out on their own.
+// The reverb/chorus program (macro) presets the parameters following it,
+// so it must not share a packet with them. System parameters (40 00 xx)
+// are multi-byte or reset the synth.
+
+bool FluxSynth::_sxBlockOk( byte AddrMid, byte AddrLo )
+{
+    if (!_sxBlocks || AddrMid == 0x00) return false;
+    if (AddrMid == 0x01 && (AddrLo == 0x30 || AddrLo == 0x38)) return false;
+    return true;
+}
+
+// Fill addresses From..To-1 from the shadow state, at block offset Pos.
+
+bool FluxSynth::_sxFill( byte From, byte To, byte Pos )
+{
+    if (To - From > SX_GAP_MAX) return false;
+    for( byte a = From; a < To; ++a )
+    {
+        byte *slot = _sxSlot( _sxBuf[0], a );
+        if (!slot || *slot == SHADOW_UNKNOWN) return false;
+        _sxBuf[ 2 + Pos++ ] = *slot;
+    }
+    return true;
+}
+
+void FluxSynth::_sxAdd( byte AddrMid, byte AddrLo, byte Value )
+{
+    byte start = _sxBuf[1], end = start + _sxLen;
+
+    if (_sxLen && AddrMid == _sxBuf[0])
+    {
+        if (AddrLo >= start && AddrLo < end)  // Overwrite
+        {
+            _sxBuf[ 2 + AddrLo - start ] = Value;
+            return;
+        }
+        if (AddrLo >= end && AddrLo - start < _sxMax 
+            && _sxFill( end, AddrLo, _sxLen ))  // Append
+        {
+            _sxLen = AddrLo - start + 1;
+            _sxBuf[ 2 + AddrLo - start ] = Value;
+            return;
+        }
+        if (AddrLo < start && end - AddrLo <= _sxMax)  // Prepend
+        {
+            byte shift = start - AddrLo;
+            byte keep[ SX_BLOCK_MAX ];
+            memcpy( keep, &_sxBuf[2], _sxLen );
+            _sxBuf[1] = AddrLo;
+            if (_sxFill( AddrLo + 1, start, 1 ))
+            {
+                memcpy( &_sxBuf[ 2 + shift ], keep, _sxLen );
+                _sxBuf[2] = Value;
+                _sxLen += shift;
+                return;
+            }
+            _sxBuf[1] = start; // No luck, restore
+            memcpy( &_sxBuf[2], keep, _sxLen );
+        }
+    }
+    _sxFlush();
+    _sxBuf[0] = AddrMid;
+    _sxBuf[1] = AddrLo;
+    _sxBuf[2] = Value;
+    _sxLen = 1;
+}
+
+void FluxSynth::_sxFlush()
+{
+    if (!_sxLen) return;
+    byte n = _sxLen;
+    _sxLen = 0; // Before sending, _writePort would flush again
+    _sendDT1( _sxBuf[0], _sxBuf[1], &_sxBuf[2], n );
 }
 
 /*
@@ -150,9 +1554,9 @@ void FluxSynth::sendParameterDataEx( byte moduleNr, byte *Data, word Length )
         ME_EOX      // End of exclusive
     };
     _runStat = ME_SYSEX;
-    writePort( head, 6 );
-    writePort( Data, Length );
-    writePort( tail, 2 );
+    _writePort( head, 6 );
+    _writePort( Data, Length );
+    _writePort( tail, 2 );
 }
 
 void FluxSynth::sendPartParameterEx( 
@@ -190,9 +1594,7 @@ void FluxSynth::_sendDreamControl( byte FuncNr, byte Value )
 
 void FluxSynth::noteOn( byte Channel, byte Key, byte Velocity ) 
 {
-    byte data[2] = { MIDIDATA( Key ), MIDIDATA( Velocity )};
-    writeMidiCmd(_MIDICOMM( ME_NOTEON, Channel ));
-    writePort( data, 2 );
+    _voiceMsg(_MIDICOMM( ME_NOTEON, Channel ), MIDIDATA( Key ), MIDIDATA( Velocity ), 2 );
 }
 
 //-----------------------------------------------------------------------------
@@ -201,9 +1603,17 @@ void FluxSynth::noteOn( byte Channel, byte Key, byte Velocity )
 
 void FluxSynth::noteOff( byte Channel, byte Key ) 
 {
-    byte data[2] = { MIDIDATA( Key ), VEL_MEZZOPIANO };
-    writeMidiCmd(_MIDICOMM( ME_NOTEOFF, Channel ));
-    writePort( data, 2 );
+    if (_noteOffOn) // 9x kk 00 shares running status with the note ons
+    {
+        noteOn( Channel, Key, 0 );
+        return;
+    }
+    _voiceMsg(_MIDICOMM( ME_NOTEOFF, Channel ), MIDIDATA( Key ), VEL_MEZZOPIANO, 2 );
+}
+
+void FluxSynth::noteOffAsNoteOn( boolean On )
+{
+    _noteOffOn = On;
 }
 
 //-----------------------------------------------------------------------------
@@ -214,9 +1624,7 @@ void FluxSynth::noteOff( byte Channel, byte Key )
 
 void FluxSynth::polyAftertouch( byte Channel, byte Key, byte Value ) 
 {
-    byte data[2] = { MIDIDATA( Key ), MIDIDATA( Value )};
-    writeMidiCmd(_MIDICOMM( ME_POLYTOUCH, Channel ));
-    writePort( data, 2 );
+    _voiceMsg(_MIDICOMM( ME_POLYTOUCH, Channel ), MIDIDATA( Key ), MIDIDATA( Value ), 2 );
 }
 
 //-----------------------------------------------------------------------------
@@ -226,9 +1634,17 @@ void FluxSynth::polyAftertouch( byte Channel, byte Key, byte Value )
 
 void FluxSynth::controlChange( byte Channel, byte CtrlNr, byte Value ) 
 {
+    if (_shadowed( _ccSlot( Channel, CtrlNr ), MIDIDATA( Value ))) return;
+    _trackParamSelect( Channel, CtrlNr );
+    if ((CtrlNr >= CT_DAMPER && CtrlNr <= CT_SOFT) 
+        || CtrlNr == CT_ALLSOUNDOFF || CtrlNr == CT_ALLNOTESOFF)
+    {   // Pedals and note offs must stay in line with the notes
+        _voiceMsg(_MIDICOMM( ME_CONTROL, Channel ), MIDIDATA( CtrlNr ), MIDIDATA( Value ), 2 );
+        return;
+    }
     byte data[2] = { MIDIDATA( CtrlNr ), MIDIDATA( Value ) };
     writeMidiCmd(_MIDICOMM( ME_CONTROL, Channel ));
-    writePort( data, 2 );
+    _writePort( data, 2 );
 }
 
 // Set 14bit continuous controller, e.g ModWheel, Expression, Volume, Pan
@@ -237,13 +1653,16 @@ void FluxSynth::controlChange( byte Channel, byte CtrlNr, byte Value )
 
 void FluxSynth::setControlValue( byte Channel, byte CtrlNr, word Value ) 
 {
+    byte *slot = _ccSlot( Channel, CtrlNr );
+    if (slot) *slot = SHADOW_UNKNOWN; // 14 bit values aren't tracked
+    _trackParamSelect( Channel, CtrlNr );
     byte mididata[4] =    // [Bx] ch hh cl ll
     {
         CtrlNr, CTV_HIGH( Value ), 
         CtrlNr + CT_LSB_DIFF, CTV_LOW( Value )
     };
     writeMidiCmd(_MIDICOMM( ME_CONTROL, Channel )); 
-    writePort( mididata, 4 );
+    _writePort( mididata, 4 );
 }
 
 //-----------------------------------------------------------------------------
@@ -253,8 +1672,11 @@ void FluxSynth::setControlValue( byte Channel, byte CtrlNr, word Value )
 
 void FluxSynth::programChange( byte Channel, byte Patch )
 {
+    #ifdef USE_SHADOW_STATE
+    if (_shadowed( &_shProg[ MIDICHAN( Channel )], MIDIDATA( Patch ))) return;
+    #endif
     writeMidiCmd(_MIDICOMM( ME_PROGCHANGE, Channel ));
-    writePort( MIDIDATA( Patch ));
+    _writePort( MIDIDATA( Patch ));
 }
 
 void FluxSynth::programChange( byte Channel, byte Bank, byte Patch )
@@ -283,8 +1705,7 @@ void FluxSynth::setPatchBank( byte Bank )
 
 void FluxSynth::channelAftertouch( byte Channel, byte Value )
 {
-    writeMidiCmd(_MIDICOMM( ME_CHANTOUCH, Channel ));
-    writePort( MIDIDATA(Value) );
+    _voiceMsg(_MIDICOMM( ME_CHANTOUCH, Channel ), MIDIDATA( Value ), 0, 1 );
 }
 
 //-----------------------------------------------------------------------------
@@ -293,9 +1714,7 @@ void FluxSynth::channelAftertouch( byte Channel, byte Value )
 
 void FluxSynth::pitchBend( byte Channel, word Bend ) 
 {
-    byte data[2] = { CTV_LOW( Bend ), CTV_HIGH( Bend ) };
-    writeMidiCmd(_MIDICOMM( ME_PITCHBEND, Channel ));
-    writePort( data, 2 );
+    _voiceMsg(_MIDICOMM( ME_PITCHBEND, Channel ), CTV_LOW( Bend ), CTV_HIGH( Bend ), 2 );
 }
 
 void FluxSynth::setBendRange( byte Channel, byte Semitones ) 
@@ -309,24 +1728,300 @@ void FluxSynth::setBendRange( byte Channel, byte Semitones )
 
 void FluxSynth::RPN_Control( byte Channel, byte rpnHi, byte rpnLo, byte Value ) 
 {
-    byte data[6] = // [Bx] 65 hi 64 lo 06 vh
-    {
-        CT_REG_MSB, MIDIDATA( rpnHi ), CT_REG_LSB, MIDIDATA( rpnLo ),
-        CT_DATAENTRY, MIDIDATA( Value )
-    };
+    if (_shadowed( _pnSlot( Channel, CT_REG_MSB, rpnHi, rpnLo ), MIDIDATA( Value ))) return;
+    byte data[2] = { CT_DATAENTRY, MIDIDATA( Value ) };
     writeMidiCmd(_MIDICOMM( ME_CONTROL, Channel ));
-    writePort( data, 6 );
+    _selectParameter( Channel, CT_REG_MSB, rpnHi, rpnLo ); // [Bx] 65 hi 64 lo
+    _writePort( data, 2 );                                  // 06 vv
 }
 
 void FluxSynth::NRPN_Control( byte Channel, byte nrpnHi, byte nrpnLo, byte Value ) 
 {
-    byte data[6] = // [Bx] 63 hi 62 lo 06 val
-    {
-        CT_NONREG_MSB, MIDIDATA( nrpnHi ), CT_NONREG_LSB, MIDIDATA( nrpnLo ),
-        CT_DATAENTRY, MIDIDATA( Value )
-    };
+    if (_shadowed( _pnSlot( Channel, CT_NONREG_MSB, nrpnHi, nrpnLo ), MIDIDATA( Value ))) return;
+    byte data[2] = { CT_DATAENTRY, MIDIDATA( Value ) };
     writeMidiCmd(_MIDICOMM( ME_CONTROL, Channel ));
-    writePort( data, 6 );
+    _selectParameter( Channel, CT_NONREG_MSB, nrpnHi, nrpnLo ); // [Bx] 63 hi 62 lo
+    _writePort( data, 2 );                                       // 06 vv
+}
+
+//# Parameter number cache
+// The synth keeps the last selected RPN/NRPN per channel, so the number only
+// has to be sent when it changes. Data entry alone then takes 2 bytes
+// instead of 6. _pnLo == PN_NONE marks an unknown selection.
+
+#define PN_NONE     0xFF  // No known parameter selected
+#define PN_NRPN     0x80  // _pnHi flag: selection is an NRPN
+
+void FluxSynth::_selectParameter( byte Channel, byte SelMsb, byte Hi, byte Lo )
+{
+    _thruSync();
+    byte ch = MIDICHAN( Channel );
+    byte hi = MIDIDATA( Hi ) | (SelMsb == CT_NONREG_MSB ? PN_NRPN : 0);
+    Lo = MIDIDATA( Lo );
+    if (_pnHi[ ch ] == hi && _pnLo[ ch ] == Lo) return; // Already selected
+
+    byte data[4] = { SelMsb, MIDIDATA( Hi ), byte( SelMsb - 1 ), Lo };
+    _writePort( data, 4 );
+    _pnHi[ ch ] = hi;
+    _pnLo[ ch ] = Lo;
+}
+
+// Plain controller writes that touch the parameter selection
+
+void FluxSynth::_trackParamSelect( byte Channel, byte CtrlNr )
+{
+    byte ch = MIDICHAN( Channel );
+    switch( CtrlNr )
+    {
+    case CT_NONREG_LSB: case CT_NONREG_MSB:
+    case CT_REG_LSB: case CT_REG_MSB:
+        _pnLo[ ch ] = PN_NONE;
+        break;
+    case CT_RESETCTRL: // Resets the selection to 'null', and the controllers
+        _pnLo[ ch ] = PN_NONE;
+        #ifdef USE_SHADOW_STATE
+        memset( _shCC[ ch ], SHADOW_UNKNOWN, SH_NUM_CC );
+        #endif
+        break;
+    #ifdef USE_SHADOW_STATE
+    case CT_DATAENTRY: case CT_DATAENT_LSB: case CT_DATAINC: case CT_DATADEC:
+        // Raw data entry, can't tell which parameter it ends up in
+        memset( _shRPN[ ch ], SHADOW_UNKNOWN, SH_NUM_RPN );
+        memset( _shNRPN[ ch ], SHADOW_UNKNOWN, SH_NUM_NRPN );
+        if (ch == 0) memset( _shDream, SHADOW_UNKNOWN, SH_NUM_DREAM );
+        break;
+    case CT_BANKSELECT: case CT_BANKSEL_LSB: // Takes effect on next program change
+        _shProg[ ch ] = SHADOW_UNKNOWN;
+        break;
+    #endif
+    }
+}
+
+void FluxSynth::invalidateParamCache()
+{
+    for( byte ch=0; ch < 16; ++ch ) _pnLo[ ch ] = PN_NONE;
+}
+
+// Drop cached selections and state the MIDI thru traffic may have changed
+
+void FluxSynth::_thruApply()
+{
+    noInterrupts();
+    word dirty = _thDirty;
+    bool all = _thDirtyAll;
+    _thDirty = 0;
+    _thDirtyAll = false;
+    interrupts();
+
+    if (all)
+    {
+        invalidateParamCache();
+        invalidateState();
+    }
+    else for( byte ch = 0; ch < 16; ++ch )
+        if (dirty & (1 << ch))
+        {
+            _pnLo[ ch ] = PN_NONE;
+            invalidateState( ch );
+        }
+}
+
+//-----------------------------------------------------------------------------
+// Shadow state
+//-----------------------------------------------------------------------------
+
+#ifdef USE_SHADOW_STATE
+
+// Tracked parameters. The position in a table is the slot index.
+
+static const byte _shCtrlTab[ SH_NUM_CC ] PROGMEM = 
+{
+    CT_BANKSELECT, CT_WHEEL, CT_PORTATIME, CT_VOLUME, CT_PAN, CT_EXPRESSION,
+    CT_DAMPER, CT_PORTAMENTO, CT_SOSTENUTO, CT_SOFT, CT_REVERB, CT_CHORUS
+};
+static const byte _shNrpnTab[ SH_NUM_NRPN ][2] PROGMEM = 
+{
+    { 0x01,0x08 }, { 0x01,0x09 }, { 0x01,0x0A }, // Vibrato rate, depth, delay
+    { 0x01,0x20 }, { 0x01,0x21 },                // TVF cutoff, resonance
+    { 0x01,0x63 }, { 0x01,0x64 }, { 0x01,0x66 }, // Envelope attack, decay, release
+    { 0x37,0x15 }, { 0x37,0x16 }, { 0x37,0x22 }, { 0x37,0x23 } // GM rev, cho, vol, pan
+};
+static const byte _shDreamTab[ SH_NUM_DREAM ] PROGMEM = // NRPN 37 xx on channel 0
+{
+    0x07, 0x13, 0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0A, 0x0B, // Level, clip, EQ
+    0x20, 0x2C, 0x2D, 0x18, 0x1A                                // Surround, routing
+    // Not 0x5F (enableEffects), EF_RESET has to go out every time.
+};
+static const byte _shPartTab[ SH_NUM_PART ] PROGMEM = // 40 1p xx
+{
+    0x02, 0x15, 0x1A, 0x1B, 0x1F, 0x20
+};
+static const byte _shSysTab[ SH_NUM_SYS ][2] PROGMEM = // 40 mm ll
+{
+    { 0x00,0x00 }, { 0x00,0x01 }, { 0x00,0x02 }, { 0x00,0x03 }, // Master tune
+    { 0x00,0x04 }, { 0x00,0x05 }, { 0x00,0x06 },  // Master volume, transpose, pan
+    { 0x01,0x30 }, { 0x01,0x31 }, { 0x01,0x32 }, { 0x01,0x33 }, // Reverb
+    { 0x01,0x34 }, { 0x01,0x35 }, { 0x01,0x36 }, { 0x01,0x37 },
+    { 0x01,0x38 }, { 0x01,0x39 }, { 0x01,0x3A }, { 0x01,0x3B }, // Chorus
+    { 0x01,0x3C }, { 0x01,0x3D }, { 0x01,0x3E }
+};
+
+static int8_t _shFind( const byte *Table, byte Count, byte Key )
+{
+    for( byte i=0; i < Count; ++i )
+        if (pgm_read_byte( &Table[ i ]) == Key) return i;
+    return -1;
+}
+
+static int8_t _shFind2( const byte (*Table)[2], byte Count, byte Hi, byte Lo )
+{
+    for( byte i=0; i < Count; ++i )
+        if (pgm_read_byte( &Table[ i ][0] ) == Hi && pgm_read_byte( &Table[ i ][1] ) == Lo) 
+            return i;
+    return -1;
+}
+
+#endif //def USE_SHADOW_STATE
+
+// Slot lookup, NULL if the parameter isn't tracked
+
+byte *FluxSynth::_ccSlot( byte Channel, byte CtrlNr )
+{
+    #ifdef USE_SHADOW_STATE
+    int8_t i = _shFind( _shCtrlTab, SH_NUM_CC, CtrlNr );
+    if (i >= 0) return &_shCC[ MIDICHAN( Channel )][ i ];
+    #endif
+    return NULL;
+}
+
+byte *FluxSynth::_pnSlot( byte Channel, byte SelMsb, byte Hi, byte Lo )
+{
+    #ifdef USE_SHADOW_STATE
+    byte ch = MIDICHAN( Channel );
+    int8_t i;
+    if (SelMsb == CT_REG_MSB)
+    {
+        if (Hi == 0 && Lo < SH_NUM_RPN) return &_shRPN[ ch ][ Lo ];
+        return NULL;
+    }
+    if ((i = _shFind2( _shNrpnTab, SH_NUM_NRPN, Hi, Lo )) >= 0) 
+        return &_shNRPN[ ch ][ i ];
+    if (ch == 0 && Hi == 0x37 && (i = _shFind( _shDreamTab, SH_NUM_DREAM, Lo )) >= 0)
+        return &_shDream[ i ];
+    #endif
+    return NULL;
+}
+
+byte *FluxSynth::_sxSlot( byte AddrMid, byte AddrLo )
+{
+    #ifdef USE_SHADOW_STATE
+    int8_t i;
+    if (HI_NIB( AddrMid ) == 0x10)
+    {
+        if ((i = _shFind( _shPartTab, SH_NUM_PART, AddrLo )) >= 0) 
+            return &_shPart[ LO_NIB( AddrMid )][ i ];
+    }
+    else if ((i = _shFind2( _shSysTab, SH_NUM_SYS, AddrMid, AddrLo )) >= 0) 
+        return &_shSys[ i ];
+    #endif
+    return NULL;
+}
+
+// Returns true if Value is already current, else records it.
+
+bool FluxSynth::_shadowed( byte *Slot, byte Value )
+{
+    #ifdef USE_SHADOW_STATE
+    if (!Slot) return false;
+    _thruSync();
+    if (*Slot == Value && !_shForce) return true;
+    *Slot = Value;
+    #endif
+    return false;
+}
+
+void FluxSynth::forceSend( boolean On )
+{
+    #ifdef USE_SHADOW_STATE
+    _shForce = On;
+    #endif
+}
+
+void FluxSynth::invalidateState()
+{
+    #ifdef USE_SHADOW_STATE
+    for( byte ch=0; ch < 16; ++ch ) invalidateState( ch );
+    memset( _shSys, SHADOW_UNKNOWN, SH_NUM_SYS );
+    memset( _shDream, SHADOW_UNKNOWN, SH_NUM_DREAM );
+    _shMasterVol = SHADOW_UNKNOWN;
+    #endif
+}
+
+void FluxSynth::invalidateState( byte Channel )
+{
+    #ifdef USE_SHADOW_STATE
+    byte ch = MIDICHAN( Channel );
+    memset( _shCC[ ch ], SHADOW_UNKNOWN, SH_NUM_CC );
+    memset( _shRPN[ ch ], SHADOW_UNKNOWN, SH_NUM_RPN );
+    memset( _shNRPN[ ch ], SHADOW_UNKNOWN, SH_NUM_NRPN );
+    memset( _shPart[ ch ], SHADOW_UNKNOWN, SH_NUM_PART );
+    _shProg[ ch ] = SHADOW_UNKNOWN;
+    #endif
+}
+
+byte FluxSynth::getControl( byte Channel, byte CtrlNr )
+{
+    _thruSync();
+    byte *slot = _ccSlot( Channel, CtrlNr );
+    return slot ? *slot : SHADOW_UNKNOWN;
+}
+
+byte FluxSynth::getProgram( byte Channel )
+{
+    _thruSync();
+    #ifdef USE_SHADOW_STATE
+    return _shProg[ MIDICHAN( Channel )];
+    #else
+    return SHADOW_UNKNOWN;
+    #endif
+}
+
+byte FluxSynth::getRPN( byte Channel, byte rpnHi, byte rpnLo )
+{
+    _thruSync();
+    byte *slot = _pnSlot( Channel, CT_REG_MSB, rpnHi, rpnLo );
+    return slot ? *slot : SHADOW_UNKNOWN;
+}
+
+byte FluxSynth::getNRPN( byte Channel, byte nrpnHi, byte nrpnLo )
+{
+    _thruSync();
+    byte *slot = _pnSlot( Channel, CT_NONREG_MSB, nrpnHi, nrpnLo );
+    return slot ? *slot : SHADOW_UNKNOWN;
+}
+
+byte FluxSynth::getPartParameter( byte Part, byte ParmNr )
+{
+    _thruSync();
+    byte *slot = _sxSlot( 0x10 | MIDICHAN( Part ), ParmNr );
+    return slot ? *slot : SHADOW_UNKNOWN;
+}
+
+byte FluxSynth::getParameter( byte AddrMid, byte AddrLo )
+{
+    _thruSync();
+    byte *slot = _sxSlot( AddrMid, AddrLo );
+    return slot ? *slot : SHADOW_UNKNOWN;
+}
+
+byte FluxSynth::getMasterVolume()
+{
+    _thruSync();
+    #ifdef USE_SHADOW_STATE
+    return _shMasterVol;
+    #else
+    return SHADOW_UNKNOWN;
+    #endif
 }
 
 void FluxSynth::dataEntry( byte Channel, byte Data ) // Provide data to RPN and NRPN
@@ -338,24 +2033,22 @@ void FluxSynth::dataEntry( byte Channel, byte Data ) // Provide data to RPN and
 
 void FluxSynth::RPN_ControlW( byte Channel, byte rpnHi, byte rpnLo, word Value ) 
 {
-    byte data[8] = // [Bx] 65 hi 64 lo 06 vh 26 vl
-    {
-        CT_REG_MSB, rpnHi, CT_REG_LSB, rpnLo, 
-        CT_DATAENTRY, CTV_HIGH( Value ), CT_DATAENT_LSB, CTV_LOW( Value )
-    };
+    byte data[4] = { CT_DATAENTRY, CTV_HIGH( Value ), CT_DATAENT_LSB, CTV_LOW( Value ) };
     writeMidiCmd(_MIDICOMM( ME_CONTROL, Channel ));
-    writePort( data, 8 );
+    _selectParameter( Channel, CT_REG_MSB, rpnHi, rpnLo ); // [Bx] 65 hi 64 lo
+    _writePort( data, 4 );                                  // 06 vh 26 vl
+    byte *slot = _pnSlot( Channel, CT_REG_MSB, rpnHi, rpnLo );
+    if (slot) *slot = SHADOW_UNKNOWN; // Shadow has 7 bit values only
 }
 
 void FluxSynth::NRPN_ControlW( byte Channel, byte nrpnHi, byte nrpnLo, word Value ) 
 {
-    byte data[8] = // [Bx] 63 hi 62 lo 06 vh 26 vl
-    {
-        CT_NONREG_MSB, nrpnHi, CT_NONREG_LSB, nrpnLo, 
-        CT_DATAENTRY, CTV_HIGH( Value ), CT_DATAENT_LSB, CTV_LOW( Value )
-    };
+    byte data[4] = { CT_DATAENTRY, CTV_HIGH( Value ), CT_DATAENT_LSB, CTV_LOW( Value ) };
     writeMidiCmd(_MIDICOMM( ME_CONTROL, Channel ));
-    writePort( data, 8 );
+    _selectParameter( Channel, CT_NONREG_MSB, nrpnHi, nrpnLo ); // [Bx] 63 hi 62 lo
+    _writePort( data, 4 );                                      // 06 vh 26 vl
+    byte *slot = _pnSlot( Channel, CT_NONREG_MSB, nrpnHi, nrpnLo );
+    if (slot) *slot = SHADOW_UNKNOWN; // Shadow has 7 bit values only
 }
 
 void FluxSynth::dataEntryW( byte Channel, word Data ) // Provide data to RPN and NRPN
@@ -385,6 +2078,12 @@ void FluxSynth::allNotesOff( byte Channel )
     
 void FluxSynth::setPartChannel( byte Part, byte Channel ) 
 {
+    #ifdef USE_NOTE_TRACKING
+    noInterrupts();
+    _pmPartCh[ MIDICHAN( Part )] = Channel;
+    _pmParts();
+    interrupts();
+    #endif
     _sendPartParameter( Part, 2, Channel );
 }
 
@@ -393,19 +2092,28 @@ void FluxSynth::setPartChannel( byte Part, byte Channel )
     
 void FluxSynth::setPartMode( byte Part, boolean Drums ) 
 {
+    #ifdef USE_NOTE_TRACKING
+    noInterrupts();
+    if (Drums) _pmDrumParts |= 1 << MIDICHAN( Part );
+    else _pmDrumParts &= ~(1 << MIDICHAN( Part ));
+    _pmParts();
+    interrupts();
+    #endif
     _sendPartParameter( Part, 0x15, Drums ? 1 : 0 );
 }
 
 // Set reserved voices. Table must contain 16 bytes with voice counts.
+// GS takes all parts in one packet, so it isn't split (setBulkUnit).
 
 void FluxSynth::setVoiceReserve( byte *Table ) 
 {
-    byte head[8] = { ME_SYSEX, 0x41, 0x00, 0x42, 0x12, 0x40, 0x01, 0x10 };
-    byte tail[2] = { 0x00, ME_EOX };
-    _runStat = ME_SYSEX;
-    writePort( head, 8 );
-    writePort( Table, 16 );
-    writePort( tail, 2 );
+    #ifdef USE_NOTE_TRACKING
+    noInterrupts();
+    memcpy( _pmPartReserve, Table, 16 );
+    _pmParts();
+    interrupts();
+    #endif
+    _sendDT1( 0x01, 0x10, Table, 16, true ); // F0 41 00 42 12 40 01 10 [16] cs F7
 }
 
 // Velocity curve
@@ -472,18 +2180,7 @@ void FluxSynth::setFineTuning( byte Channel, word CentValue )
 
 void FluxSynth::setScaleTuning( byte Channel, byte* TuningTable ) 
 {
-    byte head[8] = 
-    { 
-        ME_SYSEX, 0x41, 0x00, 0x42, 0x12, 0x40, 0x10|(Channel & 0x0F), 0x15 
-    };
-    byte tail[2] = 
-    { 
-        0x00, ME_EOX 
-    };
-    _runStat = ME_SYSEX;
-    writePort( head, 8 );
-    writePort( TuningTable, 12 );
-    writePort( tail, 2 );
+    _sendDT1( 0x10|(Channel & 0x0F), 0x15, TuningTable, 12 ); // F0 41 00 42 12 40 1p 15 [12] cs F7
 }
 
 //-----------------------------------------------------------------------------
@@ -512,19 +2209,29 @@ void FluxSynth::setDrumMix(
 
 void FluxSynth::midiReset() 
 {
-    writePort( ME_RESET );
+    invalidateParamCache();
+    invalidateState();
+    _runStat = 0;
+    _writePort( ME_RESET ); // (txNext clears the notes when it goes out)
+    _settle( _settleReset );
 }
 
 void FluxSynth::GM_Reset() // GM - General MIDI reset
 {
     byte command[6] = { ME_SYSEX, 0x7E, 0x7F, 0x09, 0x01, ME_EOX };
-    writePort( command, 6 );
+    invalidateParamCache();
+    invalidateState();
+    _pmClear();
+    _runStat = ME_SYSEX;
+    _writePort( command, 6 );
+    _settle( _settleReset );
 }
 
 void FluxSynth::GS_Reset() // GS - Reset GS settings
 {
     byte sxdata[3] = { 0, 0x7F, 0 };
     sendParameterData( sxdata, 3 );
+    _settle( _settleReset );
 }
 
 // Master volume / pan
@@ -536,7 +2243,11 @@ void FluxSynth::setMasterVolume( byte Level ) // (GM) 0..127, Default 127 (0x7F)
         ME_SYSEX, SXID_REALTIME, SX_ALLDEVS, 0x04, 0x01, 0x00, 
         MIDIDATA( Level ), ME_EOX 
     };
-    writePort( command, 8 );
+    #ifdef USE_SHADOW_STATE
+    if (_shadowed( &_shMasterVol, MIDIDATA( Level ))) return;
+    #endif
+    _runStat = ME_SYSEX;
+    _writePort( command, 8 );
 }
 
 void FluxSynth::GS_MasterVolume( byte Level ) // [GS] 0..127, Default 127 (0x7F)
@@ -604,9 +2315,11 @@ void FluxSynth::setReverb(
     byte Program, byte Time, byte Feedback, byte Character )
 {
     setReverbProgram( Program );
-    setReverbTime( Time );
-    if (Program & 0x07 > 5) setReverbFeedback( Feedback );
+    beginParameterBlock();  // 40 01 31..35 in as few packets as possible
     setReverbCharacter( Character );
+    setReverbTime( Time );
+    if ((Program & 0x07) > 5) setReverbFeedback( Feedback );
+    endParameterBlock();
 }
 
 void FluxSynth::setReverbProgram( byte Program ) 
@@ -665,10 +2378,12 @@ void FluxSynth::setChorus(
     byte Program, byte Delay, byte Feedback, byte Rate, byte Depth ) // [GS]
 {
     setChorusProgram( Program);
-    setChorusDelay( Delay );
+    beginParameterBlock();  // 40 01 3B..3E in one packet
     setChorusFeedback( Feedback );
+    setChorusDelay( Delay );
     setChorusRate( Rate );
     setChorusDepth( Depth );
+    endParameterBlock();
 }
 
 void FluxSynth::setChorusProgram( byte Program )
@@ -839,6 +2554,7 @@ void FluxSynth::setOutputLevel( byte Level )
 
 void FluxSynth::enableEffects( byte Flags ) 
 {
+    _effects = Flags;   // for voiceBudget()
     _sendDreamControl( 0x5F, Flags );
 }
 
@@ -846,7 +2562,7 @@ void FluxSynth::restartEffects()
 {
     enableEffects( EF_RESET );
     _effects = EF_ALL;
-    delay( 50 );
+    _settle( _settleFx );
 }
 
 void FluxSynth::enableReverb( boolean On ) 
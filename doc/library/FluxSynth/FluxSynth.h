@@ -99,6 +99,10 @@
 #define NO_MOD_CONTROLLERS // Agh, there's a firmware bug in SAM2195..
 // All 30 'modulation controller' sysex parameter controls are dysfunctional.
 
+#define USE_SHADOW_STATE // Remember sent values, skip unchanged ones (~580 bytes RAM)
+
+#define USE_NOTE_TRACKING // Track sounding notes, steal voices (~500 bytes RAM, needs setTxQueue)
+
 //=============================================================================
 // Command byte macros
 // Macros to handle MIDI command (status) bytes.
@@ -146,6 +150,7 @@
 #define ME_SYSEX        0xF0  // {F0 id dd..dd F7} System Exclusive message.
 #define ME_EOX          0xF7  // End of System Exclusive {F7}.
 #define ME_RESET        0xFF  // Reset all receivers to power-up status.
+#define ME_SETTLE       0xF4  // {F4 ll hh} (Undefined) FluxSynth queue marker, wait hhll ms. Never sent.
 
 // Some common sysex id's
 
@@ -355,11 +360,198 @@ word _EqTrebleHz( byte ctrlVal );
 
 bool nullSend( byte B ); // Dummy output fuction does nothing
 
+// MIDI thru routing. A zone plays the keys LowKey..HighKey of the input
+// channel on Channel, transposed by Transpose semitones, with the note on
+// velocity scaled by Velocity/64 (0 = unchanged). Channel | ZONE_HWLAYER
+// makes that part listen to the input channel instead (setPartChannel).
+// The structure is meant to be stored as is, e.g. in EEPROM.
+
+#define ROUTE_MAX_ZONES 4
+#define THRU_SYSEX_TIMEOUT 100 // ms without input before a thru sysex is ended
+#define ZONE_HWLAYER    0x80
+
+struct FluxZone
+{
+    byte    lowKey;         // Key range
+    byte    highKey;
+    byte    channel;        // Target channel 0..15, or part | ZONE_HWLAYER
+    int8_t  transpose;      // Semitones
+    byte    velocity;       // Velocity scale, 64 = 1:1 (0 = unchanged)
+};
+
+struct FluxRouting
+{
+    byte    inChannel;      // Routed input channel 0..15
+    byte    zones;          // Zones in use (0 = no routing)
+    FluxZone zone[ ROUTE_MAX_ZONES ];
+};
+
+// Byte ring buffer with one producer and one consumer.
+// Indices are bytes, so either side may run in an ISR on AVR.
+
+struct FluxQueue
+{
+    byte   *buf;            // Storage (NULL = not installed)
+    byte    size;           // Storage size, capacity is size-1
+    volatile byte head;     // Next free slot (producer)
+    volatile byte tail;     // Next byte out (consumer)
+
+    void init( byte *Buffer, byte Size );
+    bool empty() { return head == tail; }
+    byte pending();
+    bool put( byte B );     // false if full
+    int  get();             // -1 if empty
+};
+
 class FluxSynth {
 protected:
     byte    _runStat;      // MIDI running status
     byte    _effects;      // Effect enable flags
 
+    FluxQueue _txq;        // Bulk lane (buf NULL = unbuffered)
+    FluxQueue _rtq;        // Real-time lane (buf NULL = use bulk lane)
+    FluxQueue _thq;        // MIDI thru lane (buf NULL = no thru)
+    byte    _thStat;       // Thru input: running status
+    byte    _thNeed;       //  data bytes missing (FFh in sysex)
+    byte    _thMsg[3];     //  message being assembled
+    byte    _thLen;        //  and its length
+    bool    _thSkip;       //  sysex being dropped
+    unsigned long _thT;    //  last byte received (millis)
+    volatile word _thDirty;     // Channels changed by thru controllers
+    volatile bool _thDirtyAll;  // Thru sysex, may have changed anything
+    word    _thOverruns;   // Thru bytes dropped for lack of room
+    word    _thFanout;     // Extra bytes sent by thru routing
+    FluxRouting _route;    // Thru routing (zones = 0: none)
+    byte    _rtKeys[64];   // Zone mask per key, a nibble each
+    word    _rtChans;      // Zone channels, for non-note messages
+    word    _rtHwParts;    // Parts layered by setPartChannel
+    byte    _rtHeld[16];   // Routed input keys held, a bit each
+    byte    _qStat;        // Bulk lane producer: running status
+    byte    _qNeed;        //  and data bytes missing
+    byte    _qMsg[3];      //  message being assembled
+    byte    _qLen;         //  and its length
+    bool    _txMerge;      // Coalesce queued controller updates
+    word    _txMerged;     // Updates dropped by coalescing
+    byte    _dLane;        // Drain: lane of current message (0 = between messages)
+    byte    _dStat;        //  running status in that lane
+    byte    _dNeed;        //  and data bytes missing
+    byte    _wireStat;     // Running status on the wire
+    word    _txHiWater;    // Max queued bytes seen
+    word    _txStalls;     // Bytes that had to wait for a full queue
+    unsigned long _txWait;      // Time spent handing bytes to sendByte or waiting (us)
+    unsigned long _rtT0;        // When the real-time lane last became busy (us)
+    volatile bool _settling;    // Output held until the synth has settled
+    word    _settleMs;     //  for this long
+    byte    _dSettle;      // Drain: settle marker bytes to come
+    volatile byte _settleQueued; // Settle markers not reached by the drain yet
+    unsigned long _settleT0;    //  from here (ms)
+    word    _settleReset;  // Settle time after resets (ms)
+    word    _settleFx;     //  and after restartEffects
+    unsigned long _rtMaxWait;   // Longest real-time message wait (us)
+    void  (*_txKick)();    // Drain notification, e.g. enable UART TX interrupt
+
+    byte    _pnHi[16];     // Selected RPN/NRPN number per channel (cache)
+    byte    _pnLo[16];
+
+#ifdef USE_SHADOW_STATE
+    // Shadow state -- last value sent, SHADOW_UNKNOWN if not known.
+    // Only the parameters listed in the tables in FluxSynth.cpp are kept.
+    #define SH_NUM_CC    12 // Tracked controllers per channel
+    #define SH_NUM_RPN   3  // RPN 0,1,2 (bend range, fine and coarse tuning)
+    #define SH_NUM_NRPN  12 // Vibrato, TVF, envelope and GM NRPNs
+    #define SH_NUM_PART  6  // GS part parameters (40 1p xx)
+    #define SH_NUM_SYS   22 // GS system and effect parameters (40 00 xx, 40 01 xx)
+    #define SH_NUM_DREAM 15 // Dream controls (NRPN 37 xx on channel 0)
+
+    byte    _shCC[16][SH_NUM_CC];
+    byte    _shProg[16];
+    byte    _shRPN[16][SH_NUM_RPN];
+    byte    _shNRPN[16][SH_NUM_NRPN];
+    byte    _shPart[16][SH_NUM_PART];
+    byte    _shSys[SH_NUM_SYS];
+    byte    _shDream[SH_NUM_DREAM];
+    byte    _shMasterVol;
+    boolean _shForce;
+#endif
+#ifdef USE_NOTE_TRACKING
+    // Sounding notes as seen on the wire, tracked by txNext.
+    // The list is in note on order, for the steal policies.
+    #define PM_MAX_NOTES 64 // SAM2195 polyphony
+    #define PM_HELD      0x80 // List flag: released, held by the damper pedal
+
+    struct PolyNote { byte chan, key, vel; };
+
+    byte    _pmKeys[16][16];            // Active note bitmap, [channel][key/8]
+    PolyNote _pmList[ PM_MAX_NOTES ];   // Active notes, oldest first
+    byte    _pmCount;                   // Notes in _pmList
+    byte    _pmChCount[16];             // Notes per channel
+    byte    _pmReserve[16];             // Voice reserve per channel
+    byte    _pmPartReserve[16];         // Voice reserve per part (setVoiceReserve)
+    byte    _pmPartCh[16];              // Channel of each part, > 15 is off
+    word    _pmDrumParts;               // Parts in drum mode
+    word    _pmSustain;                 // Channels with damper down
+    word    _pmDrums;                   // Drum channels, not tracked
+    byte    _pmPolicy;                  // STEAL_xxx
+    byte    _pmHeadroom;                // Voices kept free
+    word    _pmSteals;                  // Notes stolen
+    byte    _pmInj[3];                  // Note off for a stolen note, sent first
+    byte    _pmInjLen, _pmInjPos;
+
+    bool _pmCheck( FluxQueue &Q );
+    void _pmNoteOn( byte Chan, byte Key, byte Vel );
+    void _pmNoteOff( byte Chan, byte Key, bool Force );
+    void _pmRemove( byte Index );
+    void _pmUnlist( byte Index );
+    void _pmSteal( byte Index );
+    byte _pmVictim();
+    void _pmClearChannel( byte Chan );
+    void _pmParts();
+#endif
+    void _pmClear();
+    void _settle( word Ms );
+    FluxQueue &_lane( byte Lane ) { return (Lane == 1) ? _rtq : (Lane == 3) ? _thq : _txq; }
+
+    byte *_ccSlot( byte Channel, byte CtrlNr );
+    byte *_pnSlot( byte Channel, byte SelMsb, byte Hi, byte Lo );
+    byte *_sxSlot( byte AddrMid, byte AddrLo );
+    bool _shadowed( byte *Slot, byte Value );
+
+    #define SX_BLOCK_MAX 16 // Max data bytes in a gathered DT1 packet
+    byte    _sxBuf[ 2 + SX_BLOCK_MAX ]; // Pending parameter block, address first
+    byte    _sxLen;        // Pending data bytes
+    byte    _sxMax;        // Max data bytes per packet (see setBulkUnit)
+    byte    _sxGather;     // beginParameterBlock nesting
+    boolean _sxBlocks;     // Multi-byte DT1 writes allowed
+
+    void _sendDT1( byte AddrMid, byte AddrLo, byte *Data, word Count, bool Whole = false );
+    bool _sxBlockOk( byte AddrMid, byte AddrLo );
+    bool _sxFill( byte From, byte To, byte Pos );
+    void _sxAdd( byte AddrMid, byte AddrLo, byte Value );
+    void _sxFlush();
+
+    byte   *_bBuf;         // Batch buffer (NULL = not batching)
+    byte    _bSize;        // Batch buffer size
+    byte    _bLen;         // Bytes collected
+    byte    _bRunStat;     // Running status when the batch began
+    byte    _bLastStat;    // Last status collected
+    byte    _bNeed;        // Data bytes missing in the last message (FFh: sysex)
+    byte    _bMsgs;        // Messages collected
+    boolean _noteOffOn;    // Send note off as note on, velocity 0
+
+    void _batchPut( byte B );
+    void _qPut( FluxQueue &Q, byte B );
+    void _txPut( byte B );
+    void _voiceMsg( byte Cmd, byte D1, byte D2, byte Len );
+    bool _coalesce( FluxQueue &Q, byte *Msg, byte Len );
+    bool _thPut( byte B, byte Reserve );
+    void _thEndSysex();
+    void _thruApply();
+    void _thRoute();
+    void _thruSync() { if (_thDirty || _thDirtyAll) _thruApply(); }
+    void _writePort( byte B );
+    void _writePort( byte *Buf, word Count );
+    void _selectParameter( byte Channel, byte SelMsb, byte Hi, byte Lo );
+    void _trackParamSelect( byte Channel, byte CtrlNr );
     void _sendPartParameter( byte Part, byte ParmNr, byte CtrlVal );
     void _sendModParameter( byte Channel, byte ParmNr, byte CtrlVal );
     void _sendDreamControl( byte FuncNr, byte Value );
@@ -379,11 +571,136 @@ public:
     void writeMidiCmd( byte Cmd );  
     void sendParameterData( byte *Data, word Length ); 
 
+    // Parameter blocks
+    // Single GS parameter writes (sendParameterData with one value) made
+    // between these calls are merged into one DT1 packet per run of
+    // neighbouring addresses. setReverb and setChorus do this internally.
+    // enableBlockSysex(false) sends every parameter in its own packet.
+
+    void beginParameterBlock();
+    void endParameterBlock();
+    void enableBlockSysex( boolean On );
+
+    // Buffered output
+    // With a transmit queue installed, writePort only stores bytes and
+    // returns at once. The queue is emptied either by calling txService
+    // from loop(), or by a UART TX-empty ISR calling txNext (use one or
+    // the other). Kick is called whenever bytes are queued, so an ISR
+    // driven transport can (re)enable its TX interrupt.
+    // Size may be 2..255 bytes, the usable capacity is Size-1.
+    //
+    // A full queue makes writePort wait for room; txStalls counts
+    // those bytes, so a non-zero value means the queue is too small.
+    // txWaitTime is the time the caller spent on output, in microseconds:
+    // in txService (i.e. in sendByte) and waiting for room in the queue.
+    // With an interrupt driven sendByte it should stay at zero.
+    //
+    // setRtQueue adds a second, real-time lane for note on/off, pitch bend,
+    // aftertouch, the pedals and all notes/sound off. Those are sent ahead of
+    // queued bulk data as soon as the message on the wire is complete.
+    // setBulkUnit limits the size of GS parameter packets (default 26
+    // bytes), longer writes are split into several. That bounds the wait to
+    // about MaxBytes * 320us, except behind packets that must go whole:
+    // setVoiceReserve (26 bytes), system parameters (40 00 xx, up to 14),
+    // raw writePort data and thru sysex. rtMaxWait reports the longest wait
+    // actually seen, in microseconds.
+    // Notes overtake bulk data still in the queue, call txFlush first
+    // if a note must hear a program or controller change sent before it.
+    //
+    // While queued, a newer controller, pitch bend or NRPN value replaces
+    // an older one for the same target that hasn't been sent yet.
+    // txMerged counts the updates dropped that way. setCoalescing(false)
+    // sends every value.
+    //
+    // Resets (midiReset, GM_Reset, GS_Reset) and restartEffects need the
+    // synth to settle before it listens again. With a queue that's done by
+    // holding the output (500 and 50 ms by default, see setSettleTime)
+    // rather than by delay(). settling() is true from the call until the
+    // synth listens again, also while the command still waits in the queue.
+    // Nothing drains meanwhile, so a write that finds the queue full waits
+    // for the settle to end: check settling() or txFree() before sending a
+    // lot. Without a queue they delay() as before.
+    //
+    // setThruQueue enables MIDI thru: feed the received bytes to thruByte,
+    // (typically from the UART receive interrupt) and they are merged with
+    // the local output message by message. Messages that don't fit in the
+    // thru queue are dropped and counted by thruOverruns. A sysex that is
+    // cut short (overrun, another status byte, no input for
+    // THRU_SYSEX_TIMEOUT ms) is ended with an EOX.
+    //
+    // setThruRouting splits, layers and remaps one input channel into up
+    // to ROUTE_MAX_ZONES zones (see FluxRouting). Every copy beyond the
+    // first costs link bandwidth, thruFanout counts those bytes. A routing
+    // that is out of range is taken as none. Notes held through the old
+    // zones get their note offs when the routing changes.
+
+    void setTxQueue( byte *Buffer, byte Size, void (*Kick)() = NULL );
+    void setRtQueue( byte *Buffer, byte Size );
+    void setBulkUnit( byte MaxBytes );
+    void setCoalescing( bool On );
+    void setSettleTime( word ResetMs, word EffectsMs );
+    boolean settling();
+    void setThruQueue( byte *Buffer, byte Size );
+    void thruByte( byte B );
+    word thruOverruns();
+    void setThruRouting( const FluxRouting &Routing );
+    word thruFanout();
+    int  txNext();
+    word txService( word MaxBytes = 0xFFFF );
+    void txFlush();
+    word txPending();
+    byte txFree();
+    word txHighWater() { return _txHiWater; }
+    word txStalls() { return _txStalls; }
+    unsigned long txWaitTime() { return _txWait; }
+    word txMerged();
+    unsigned long rtMaxWait();
+    void txResetStats();
+
+    // Shadow state
+    // With USE_SHADOW_STATE, FluxSynth remembers the last value sent for
+    // the common controllers, program/bank, RPN 0-2, the patch NRPNs,
+    // GS part parameters, and the global GS/Dream effect parameters.
+    // Setters skip the output when the value is already current. Anything
+    // not tracked is always sent, and the getters return SHADOW_UNKNOWN.
+    //
+    // The state is forgotten on midiReset, GM_Reset, GS_Reset and raw
+    // writePort output. Use forceSend to push values regardless, e.g
+    // after the synth was power cycled.
+
+    #define SHADOW_UNKNOWN  0xFF  // Value not known (or not tracked)
+
+    void forceSend( boolean On );
+    void invalidateState();
+    void invalidateState( byte Channel );
+
+    byte getControl( byte Channel, byte CtrlNr );
+    byte getProgram( byte Channel );
+    byte getBank( byte Channel ) { return getControl( Channel, CT_BANKSELECT ); }
+    byte getRPN( byte Channel, byte rpnHi, byte rpnLo );
+    byte getNRPN( byte Channel, byte nrpnHi, byte nrpnLo );
+    byte getPartParameter( byte Part, byte ParmNr );
+    byte getParameter( byte AddrMid, byte AddrLo );
+    byte getDreamControl( byte FuncNr ) { return getNRPN( 0, 0x37, FuncNr ); }
+    byte getMasterVolume();
+
+    // Batches
+    // Output between beginBatch and commit is collected in Buffer, then
+    // reordered to maximize running status and sent in one go. Messages on
+    // one channel keep their order unless they commute. Sysex and other
+    // system messages stay in place, nothing moves across them.
+    // commit returns the number of bytes saved compared to sending the
+    // same messages unbatched. Size up to 255 bytes, max 32 messages.
+
+    void beginBatch( byte *Buffer, byte Size );
+    word commit();
+
     // SAM2195 Channel control
     // These methods control a single MIDI channel.
 
     void noteOn( byte Channel, byte Key, byte Velocity );
     void noteOff( byte Channel, byte Key );
+    void noteOffAsNoteOn( boolean On ); // Send note off as 9x kk 00
     void controlChange( byte Channel, byte CtrlNr, byte Value );
     void setControlValue( byte Channel, byte CtrlNr, word Value );
     void programChange( byte Channel, byte Patch );
@@ -397,10 +714,47 @@ public:
     void RPN_Control( byte Channel, byte rpnHi, byte rpnLo, byte Data );
     void NRPN_Control( byte Channel, byte nrpnHi, byte nrpnLo, byte Data );
     void dataEntry( byte Channel, byte Data );
+    #ifdef HAVE_14B_CONTROLLER
+    void RPN_ControlW( byte Channel, byte rpnHi, byte rpnLo, word Value );
+    void NRPN_ControlW( byte Channel, byte nrpnHi, byte nrpnLo, word Value );
+    void dataEntryW( byte Channel, word Data );
+    void setFineTuning( byte Channel, word CentValue );
+    #endif
+
+    // RPN/NRPN_Control (and the W variants) only send the parameter number
+    // when it differs from the one last selected on the channel. The cache
+    // is cleared by resets (midiReset, GM_Reset, GS_Reset), by raw writePort
+    // output, and by controlChange on the RPN/NRPN number controllers. Call
+    // this if the synth may have been addressed behind FluxSynth's back.
+
+    void invalidateParamCache();
 
     void setChannelVolume( byte Channel, byte Level );
     void allNotesOff( byte Channel );
 
+    // Polyphony manager (USE_NOTE_TRACKING, queued output only)
+    // Notes are tracked as they go out, drum channels excepted. When a note
+    // on would exceed the voice budget (64 minus what the enabled effects
+    // take, minus Headroom) a sounding note is released first, rather than
+    // leaving the choice to the chip. Notes held only by the damper pedal go
+    // first, and channels within their setVoiceReserve count are spared.
+    // Drum parts and voice reserves go by the channel each part is set to
+    // (setPartChannel, GS defaults after a reset).
+    // panic releases just the notes that are actually sounding, or sends
+    // all notes off on every channel without a queue.
+
+    #define STEAL_NONE     0 // Track only
+    #define STEAL_OLDEST   1 // Note on longest ago
+    #define STEAL_QUIETEST 2 // Lowest velocity
+    #define STEAL_SAMEKEY  3 // Repeated key releases itself first, else oldest
+
+    void setStealPolicy( byte Policy, byte Headroom = 0 );
+    byte voiceBudget();
+    byte activeNotes();
+    boolean isNoteOn( byte Channel, byte Key );
+    word voiceSteals();
+    void panic();
+
     void setPartChannel( byte Part, byte Channel );
     void setPartMode( byte Part, boolean Drums );
     void setVoiceReserve( byte *CountTable );
@@ -0,0 +1,217 @@
+//
+// Setup library on a host: create, list and copy records of the file the
+// sketch keeps on the SD card (SETUP_LIBRARY_SD), and time slot lookups.
+//
+// Build: g++ -O2 -I. -o setuplib tools/setuplib.cpp SetupLibrary.cpp
+//
+// setuplib FILE format [SLOTS]   new library, all slots empty
+// setuplib FILE list             used slots: type, version, length, CRC ok
+// setuplib FILE put N TYPE IN [VERSION]  record N from file IN
+// setuplib FILE get N OUT        record N to file OUT
+// setuplib FILE erase N
+// setuplib FILE bench [LOOKUPS]  random record reads
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "SetupLibrary.h"
+
+class FileMedia : public LibraryMedia
+{
+  public:
+    FILE *file;
+
+    FileMedia() { file = 0; }
+
+    bool open(const char *name, bool create)
+    {
+      file = fopen(name, "r+b");
+      if (!file && create)
+        file = fopen(name, "w+b");
+      return (file != 0);
+    }
+
+    long size()
+    {
+      fseek(file, 0, SEEK_END);
+      return (ftell(file));
+    }
+
+    bool read(uint32_t pos, uint8_t *buf, uint16_t len)
+    {
+      if (pos + len > size() || fseek(file, pos, SEEK_SET) != 0)
+        return (false);
+      return (fread(buf, 1, len, file) == len);
+    }
+
+    // Like SdMedia in the sketch, gaps are padded with 0xFF
+    bool write(uint32_t pos, const uint8_t *buf, uint16_t len)
+    {
+      long s = size();
+
+      for (; s < long(pos); s++)
+        if (fputc(0xff, file) == EOF)
+          return (false);
+      if (fseek(file, pos, SEEK_SET) != 0)
+        return (false);
+      return (fwrite(buf, 1, len, file) == len);
+    }
+
+    void sync()
+    {
+      fflush(file);
+    }
+};
+
+static FileMedia media;
+static SetupLibrary library;
+
+static int usage(void)
+{
+  fprintf(stderr, "usage: setuplib FILE format [SLOTS] | list | put N TYPE IN [VERSION] | get N OUT | erase N | bench [LOOKUPS]\n");
+  return (2);
+}
+
+static bool slot_arg(const char *s, uint16_t &n)
+{
+  long v = strtol(s, 0, 0);
+
+  if (v < 0 || v >= library.slots())
+  {
+    fprintf(stderr, "slot %s not in 0..%u\n", s, library.slots() - 1);
+    return (false);
+  }
+  n = uint16_t(v);
+  return (true);
+}
+
+static int list(void)
+{
+  uint16_t n, length, used = 0;
+  uint8_t type;
+
+  for (n = 0; n < library.slots(); n++)
+  {
+    if (!library.openRecord(n, type, length))
+      continue;
+    printf("%4u  type %u  version 0x%02X  %3u bytes  %s\n", n, type, library.version(), length,
+           library.verifyRecord(n) ? "ok" : "CRC error");
+    used++;
+  }
+  printf("%u of %u slots used\n", used, library.slots());
+  return (0);
+}
+
+static int put(uint16_t n, uint8_t type, uint8_t version, const char *name)
+{
+  uint8_t buf[LIB_MAX_RECORD + 1];
+  size_t length;
+  FILE *in = fopen(name, "rb");
+
+  if (!in)
+  {
+    perror(name);
+    return (1);
+  }
+  length = fread(buf, 1, sizeof(buf), in);
+  fclose(in);
+  if (length > LIB_MAX_RECORD)
+  {
+    fprintf(stderr, "%s: more than %u bytes\n", name, LIB_MAX_RECORD);
+    return (1);
+  }
+  // In pieces, as the sketch does it
+  if (!library.createRecord(n, type, length, version))
+    return (1);
+  for (size_t i = 0; i < length; i += 32)
+    library.write(&buf[i], length - i < 32 ? length - i : 32);
+  return (library.writeEnd() ? 0 : 1);
+}
+
+static int get(uint16_t n, const char *name)
+{
+  uint8_t buf[LIB_MAX_RECORD], type;
+  uint16_t length;
+  FILE *out;
+
+  if (!library.openRecord(n, type, length))
+  {
+    fprintf(stderr, "slot %u is empty\n", n);
+    return (1);
+  }
+  library.read(buf, length);
+  if (!library.readEnd())
+  {
+    fprintf(stderr, "slot %u: CRC error\n", n);
+    return (1);
+  }
+  out = fopen(name, "wb");
+  if (!out || fwrite(buf, 1, length, out) != length)
+  {
+    perror(name);
+    return (1);
+  }
+  fclose(out);
+  return (0);
+}
+
+static int bench(long lookups)
+{
+  uint8_t buf[LIB_MAX_RECORD], type;
+  uint16_t length;
+  long i, found = 0;
+  clock_t t;
+
+  srand(1);
+  t = clock();
+  for (i = 0; i < lookups; i++)
+  {
+    if (!library.openRecord(rand() % library.slots(), type, length))
+      continue;
+    library.read(buf, length);
+    found += library.readEnd();
+  }
+  t = clock() - t;
+  printf("%ld lookups, %ld records read, %.2f us per lookup\n", lookups, found,
+         1e6 * t / CLOCKS_PER_SEC / lookups);
+  return (0);
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t n;
+
+  if (argc < 3)
+    return (usage());
+  if (strcmp(argv[2], "format") == 0)
+  {
+    if (!media.open(argv[1], true))
+    {
+      perror(argv[1]);
+      return (1);
+    }
+    return (library.format(&media, argc > 3 ? atoi(argv[3]) : 500) ? 0 : 1);
+  }
+  if (!media.open(argv[1], false))
+  {
+    perror(argv[1]);
+    return (1);
+  }
+  if (!library.begin(&media))
+  {
+    fprintf(stderr, "%s: no setup library\n", argv[1]);
+    return (1);
+  }
+  if (strcmp(argv[2], "list") == 0)
+    return (list());
+  if (strcmp(argv[2], "put") == 0 && (argc == 6 || argc == 7))
+    return (slot_arg(argv[3], n) ? put(n, atoi(argv[4]), argc == 7 ? strtol(argv[6], 0, 0) : 0, argv[5]) : 1);
+  if (strcmp(argv[2], "get") == 0 && argc == 5)
+    return (slot_arg(argv[3], n) ? get(n, argv[4]) : 1);
+  if (strcmp(argv[2], "erase") == 0 && argc == 4)
+    return (slot_arg(argv[3], n) && library.erase(n) ? 0 : 1);
+  if (strcmp(argv[2], "bench") == 0)
+    return (bench(argc > 3 ? atol(argv[3]) : 100000));
+  return (usage());
+}
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+#
+# Generate FluxVoiceNames.h from tools/voicenames.txt and the GM families
+# in PgmChange.h
+#
+# Run from the sketch folder after changing a name:
+#   python3 tools/voicenames.py > FluxVoiceNames.h
+#
+# The names are CamelCase words ("Elec" "Grand" "Piano"). Words that save
+# flash go to a dictionary of up to 128 words, each name is then a string
+# of codes: a byte below 0x80 is a character, 0x80 + n is word n. Instead
+# of a pointer per name, there's a start offset per 16 names and a 4 bit
+# code count per name. voiceName() in the sketch decodes a name with at
+# most 15 count and 15 code reads, plus the characters it writes.
+#
+# For browsing there's the family of each program (GM by its number, the
+# MT-32 ones as listed in voicenames.txt), the first program of each family
+# per bank, and the programs of each bank in alphabetical order with where
+# each first letter starts.
+#
+import re
+import sys
+from collections import Counter
+
+VOICES = 256
+GROUP = 16
+MAX_WORDS = 128
+MAX_CODES = 15  # fits a nibble
+MAX_NAME = 16  # LCD field, voice_name[17] in the sketch
+BANK = 128
+NO_PROGRAM = 0xFF
+PGMCHANGE = 'doc/library/FluxSynth/PgmChange.h'
+
+
+def read_names(path):
+    voices, drums, mt32, section = [], [], [], None
+    for line in open(path):
+        line = line.strip()
+        if not line or line.startswith('#'):
+            continue
+        if line.startswith('['):
+            section = line
+        elif section == '[voices]':
+            voices.append(line)
+        elif section == '[drums]':
+            drums.append(line.split())
+        elif section == '[mt32 families]':
+            first, family = line.split(None, 1)
+            mt32.append((int(first), family))
+    return voices, drums, mt32
+
+
+# GM families: the @name sections of the GM bank, in program order
+def read_families(path):
+    families, family = [], {}
+    name = None
+    for line in open(path):
+        m = re.match(r'//! @name (.*)', line)
+        if m:
+            name = m.group(1).strip()
+        m = re.match(r'#define GM_\w+\s+(\d+)', line)
+        if m:
+            if name not in families:
+                families.append(name)
+            family[int(m.group(1))] = families.index(name)
+    if len(families) != 16 or len(family) != BANK:
+        sys.exit('%s: %d GM families, %d programs' % (path, len(families), len(family)))
+    return families, [family[p] for p in range(BANK)]
+
+
+def mt32_families(mt32, families):
+    family = []
+    for i, (first, name) in enumerate(mt32):
+        last = mt32[i + 1][0] if i + 1 < len(mt32) else BANK
+        if name not in families or first != len(family):
+            sys.exit('bad MT-32 family line: %d %s' % (first, name))
+        family += [families.index(name)] * (last - first)
+    return family
+
+
+# Programs of a bank in alphabetical order, and where each letter starts
+def alphabet(names):
+    order = sorted(range(BANK), key=lambda p: (names[p].lower(), p))
+    letters = []
+    for i in range(27):
+        letters.append(sum(1 for p in order if ord(names[p][0].upper()) - ord('A') < i))
+    return order, letters
+
+
+def words(name):
+    return re.findall(r'[A-Z][a-z]*|[a-z]+|[0-9]+|[^A-Za-z0-9]+', name)
+
+
+# A word costs its characters and a 2 byte start in the dictionary, and
+# saves all but one byte where it's used
+def dictionary(voices):
+    count = Counter(w for name in voices for w in words(name))
+    gain = {w: count[w] * (len(w) - 1) - len(w) - 2 for w in count}
+    best = sorted((w for w in gain if gain[w] > 0), key=lambda w: (-gain[w], w))
+    return sorted(best[:MAX_WORDS])
+
+
+def encode(name, index):
+    codes = []
+    for w in words(name):
+        if w in index:
+            codes.append(0x80 + index[w])
+        else:
+            codes.extend(ord(c) for c in w)
+    return codes
+
+
+def table(values, per_line=16):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append('  ' + ', '.join(str(v) for v in values[i:i + per_line]))
+    return ',\n'.join(lines)
+
+
+def main():
+    voices, drums, mt32 = read_names(sys.argv[1] if len(sys.argv) > 1 else 'tools/voicenames.txt')
+    families, family = read_families(sys.argv[2] if len(sys.argv) > 2 else PGMCHANGE)
+    if len(voices) != VOICES:
+        sys.exit('%d voice names, need %d' % (len(voices), VOICES))
+    for name in voices:
+        if len(name) > MAX_NAME or any(ord(c) >= 0x80 for c in name) or not 'A' <= name[0] <= 'Z':
+            sys.exit('bad voice name: ' + name)
+
+    dict_words = dictionary(voices)
+    index = {w: i for i, w in enumerate(dict_words)}
+    starts, chars = [], ''
+    for w in dict_words:
+        starts.append(len(chars))
+        chars += w
+    starts.append(len(chars))
+
+    text, groups, lengths = [], [], []
+    for n, name in enumerate(voices):
+        codes = encode(name, index)
+        if len(codes) > MAX_CODES:
+            sys.exit('voice name needs %d codes: %s' % (len(codes), name))
+        if n % GROUP == 0:
+            groups.append(len(text))
+        lengths.append(len(codes))
+        text.extend(codes)
+    nibbles = [lengths[i] | (lengths[i + 1] << 4) for i in range(0, VOICES, 2)]
+
+    old = sum(len(name) + 1 for name in voices) + 2 * VOICES
+    new = len(chars) + 2 * len(starts) + 2 * len(groups) + len(nibbles) + len(text)
+    sys.stderr.write('voice names: %d bytes, were %d\n' % (new, old))
+
+    family += mt32_families(mt32, families)
+    family_nibbles = [family[i] | (family[i + 1] << 4) for i in range(0, VOICES, 2)]
+    family_first = []
+    for bank in range(VOICES // BANK):
+        for f in range(len(families)):
+            programs = [p for p in range(BANK) if family[bank * BANK + p] == f]
+            family_first.append(programs[0] if programs else NO_PROGRAM)
+    alpha, letters = [], []
+    for bank in range(VOICES // BANK):
+        order, start = alphabet(voices[bank * BANK:(bank + 1) * BANK])
+        alpha += order
+        letters += start
+    index = len(family_nibbles) + len(family_first) + len(alpha) + len(letters)
+    sys.stderr.write('voice index: %d bytes\n' % index)
+
+    out = sys.stdout
+    out.write('//\n'
+              '// Storing names of the voices in PROGMEM\n'
+              '//\n'
+              '// Generated by tools/voicenames.py from tools/voicenames.txt, change the\n'
+              '// names there. %d bytes of flash (%d as plain strings).\n'
+              '//\n' % (new, old))
+    out.write('#ifndef FLUXVOICENAMES_H\n#define FLUXVOICENAMES_H 1\n\n')
+    out.write('#define VOICE_NAMES %d\n' % VOICES)
+    out.write('#define VOICE_GROUP %d // names per _voice_group entry\n' % GROUP)
+    out.write('#define VOICE_WORD 0x80 // first dictionary code\n\n')
+    out.write('// Dictionary: word n is _voice_words[_voice_word_start[n]] up to the\n'
+              '// start of word n + 1\n')
+    out.write('const char _voice_words[] PROGMEM =\n')
+    for i in range(0, len(dict_words), 8):
+        out.write('  "%s"\n' % ''.join(dict_words[i:i + 8]))
+    out.write('  ;\n\n')
+    out.write('const uint16_t _voice_word_start[] PROGMEM = {\n%s\n};\n\n' % table(starts, 12))
+    out.write('// Names: codes in _voice_text from _voice_group[n / VOICE_GROUP] on,\n'
+              '// code counts in nibbles, low nibble first\n')
+    out.write('const uint16_t _voice_group[] PROGMEM = {\n%s\n};\n\n' % table(groups, 12))
+    out.write('const uint8_t _voice_length[] PROGMEM = {\n%s\n};\n\n' % table(nibbles))
+    out.write('const uint8_t _voice_text[] PROGMEM = {\n%s\n};\n\n' % table(text))
+
+    out.write('// Browsing index, %d bytes. Families as in PgmChange.h, drum kits\n'
+              '// are browsed by _drum_prog_map:\n' % index)
+    for i in range(0, len(families), 4):
+        out.write('// %s\n' % ', '.join('%d %s' % (f, families[f]) for f in range(i, min(i + 4, len(families)))))
+    out.write('#define VOICE_FAMILIES %d\n' % len(families))
+    out.write('#define VOICE_NO_PROGRAM 0x%02X // family not in the bank\n\n' % NO_PROGRAM)
+    out.write('// Family of each name, in nibbles like _voice_length\n')
+    out.write('const uint8_t _voice_family[] PROGMEM = {\n%s\n};\n\n' % table(family_nibbles))
+    out.write('// First program of each family, per bank\n')
+    out.write('const uint8_t _voice_family_first[][VOICE_FAMILIES] PROGMEM = {\n%s\n};\n\n'
+              % ',\n'.join('  { %s }' % ', '.join(str(v) for v in family_first[i:i + len(families)])
+                           for i in range(0, len(family_first), len(families))))
+    out.write('// Programs of each bank in alphabetical order, _voice_letter has where\n'
+              '// A-Z start in it (and the end)\n')
+    out.write('const uint8_t _voice_alpha[][128] PROGMEM = {\n%s\n};\n\n'
+              % ',\n'.join('  {\n%s\n  }' % table(alpha[i:i + BANK]).replace('\n', '\n  ').replace('  ', '    ', 1)
+                           for i in range(0, len(alpha), BANK)))
+    out.write('const uint8_t _voice_letter[][27] PROGMEM = {\n%s\n};\n\n'
+              % ',\n'.join('  { %s }' % ', '.join(str(v) for v in letters[i:i + 27])
+                           for i in range(0, len(letters), 27)))
+
+    for i, (name, prog) in enumerate(drums):
+        out.write('const char _drum%d[] PROGMEM = "%s";\n' % (i, name))
+    out.write('\nconst char * const _drum_name[] PROGMEM =\n{\n%s\n};\n\n'
+              % ',\n'.join('  _drum%d' % i for i in range(len(drums))))
+    out.write('const uint8_t _drum_prog_map[] PROGMEM = {%s};\n'
+              % ','.join(prog for name, prog in drums))
+    out.write('#endif\n')
+
+
+main()